@@ -0,0 +1,198 @@
+/**
+   @file bench_frame.c
+
+   @brief Microbenchmarks for the BME IPC framing parser
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Runs the parser over a buffer of typical frames, whole and in
+ * chunks the size a socket read tends to return, and prints the best
+ * of several runs per frame and per byte. Counts are TSC cycles on
+ * x86 and nanoseconds elsewhere.
+ *
+ *   bench_frame [frames [runs]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#include "bmeipc.h"
+#include "bmeipc-internal.h"
+#include "bmeframe.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#define UNIT "cycles"
+static inline uint64_t
+ticks(void)
+{
+  return __rdtsc();
+}
+#else
+#define UNIT "ns"
+static inline uint64_t
+ticks(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+#endif
+
+static volatile uint64_t sink;
+
+/**
+ * Fill a buffer with frames: v1 and v2 headers, payloads from a status
+ * word up to a statistics reply
+ */
+static size_t
+make_stream(unsigned char *buf, int frames)
+{
+  static const int32_t sizes[] = { 4, 8, 24, 116, 4, 64 };
+  size_t off = 0;
+  int i;
+
+  for (i = 0; i < frames; i++)
+  {
+    int32_t size = sizes[i % (sizeof sizes / sizeof sizes[0])];
+    bmeipc_header_v2 h;
+    size_t hlen = sizeof h.base;
+
+    h.base.sync = BMEIPC_SYNCWORD;
+    h.base.size = size;
+    if (i & 1)
+    {
+      h.base.sync = BMEIPC_SYNCWORD_V2;
+      h.reqid = i;
+      h.type = 0x8000;
+      h.flags = BMEIPC_F_REPLY;
+      hlen = sizeof h;
+    }
+    memcpy(buf + off, &h, hlen);
+    memset(buf + off + hlen, i, size);
+    off += hlen + size;
+  }
+  return off;
+}
+
+static uint64_t
+run_decode(const unsigned char *buf, size_t len)
+{
+  bmeipc_frame_t frame;
+  uint64_t sum = 0;
+  size_t off = 0;
+  int32_t size, hlen;
+
+  while ((hlen = bmeipc_frame_decode(buf + off, len - off, BMEIPC_PAYLOAD_MAX,
+                                     &frame, &size)) > 0)
+  {
+    sum += frame.reqid + size;
+    off += hlen + size;
+  }
+  return sum;
+}
+
+static uint64_t
+run_parse(const unsigned char *buf, size_t len, size_t chunk)
+{
+  bmeipc_parser_t parser;
+  bmeipc_parse_event_t ev;
+  uint64_t sum = 0;
+  size_t pos = 0, used;
+
+  bmeipc_parser_init(&parser, 0);
+  while (pos < len)
+  {
+    size_t end = pos + chunk < len ? pos + chunk : len;
+
+    while (pos < end)
+    {
+      switch (bmeipc_parse(&parser, buf + pos, end - pos, &used, &ev))
+      {
+      case BMEIPC_PARSE_HEADER:
+        sum += ev.frame.reqid + ev.size;
+        break;
+      case BMEIPC_PARSE_DATA:
+        sum += ev.bytes;
+        break;
+      case BMEIPC_PARSE_ERROR:
+        abort();
+      }
+      pos += used;
+    }
+  }
+  return sum;
+}
+
+int
+main(int argc, char **argv)
+{
+  static const size_t chunks[] = { 1, 7, 64, 1500, 65536 };
+  int frames = argc > 1 ? atoi(argv[1]) : 10000;
+  int runs = argc > 2 ? atoi(argv[2]) : 20;
+  unsigned char *buf;
+  size_t len, c;
+  uint64_t best;
+  int r;
+
+  if (frames <= 0 || runs <= 0 ||
+      (buf = malloc((size_t) frames * (BMEIPC_HEADER_MAX + 116))) == 0)
+  {
+    fprintf(stderr, "usage: %s [frames [runs]]\n", argv[0]);
+    return 1;
+  }
+  len = make_stream(buf, frames);
+  printf("%d frames, %zu bytes, best of %d runs\n", frames, len, runs);
+  printf("%-16s %12s %12s\n", "", UNIT "/frame", UNIT "/byte");
+
+  best = UINT64_MAX;
+  for (r = 0; r < runs; r++)
+  {
+    uint64_t t = ticks();
+    sink += run_decode(buf, len);
+    t = ticks() - t;
+    best = t < best ? t : best;
+  }
+  printf("%-16s %12.2f %12.3f\n", "decode", (double)best / frames,
+         (double)best / len);
+
+  for (c = 0; c < sizeof chunks / sizeof chunks[0]; c++)
+  {
+    char name[32];
+
+    best = UINT64_MAX;
+    for (r = 0; r < runs; r++)
+    {
+      uint64_t t = ticks();
+      sink += run_parse(buf, len, chunks[c]);
+      t = ticks() - t;
+      best = t < best ? t : best;
+    }
+    snprintf(name, sizeof name, "parse/%zu", chunks[c]);
+    printf("%-16s %12.2f %12.3f\n", name, (double)best / frames,
+           (double)best / len);
+  }
+
+  free(buf);
+  return 0;
+}
@@ -0,0 +1,80 @@
+/**
+   @file fuzz_cookie.c
+
+   @brief libFuzzer target for the BME IPC cookie handshake
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Feeds the input as what a connecting client sent, the way the
+ * server takes it apart: the parser finds the first packet and the
+ * cookie check judges it. The same payload also goes through the ack
+ * check the client side runs on the server's first packet.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "bmeipc.h"
+#include "bmeframe.h"
+
+#define CHECK(cond) do { if (!(cond)) __builtin_trap(); } while (0)
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  static const char cookie[] = BME_SRV_COOKIE;
+  bmeipc_parser_t parser;
+  bmeipc_parse_event_t ev;
+  const void *payload = data;
+  int32_t bytes = 0;
+  size_t used;
+  int32_t rc, ver;
+
+  bmeipc_parser_init(&parser, BMEIPC_COOKIE_MAX);
+  rc = bmeipc_parse(&parser, data, size, &used, &ev);
+  if (rc != BMEIPC_PARSE_HEADER)
+  {
+    CHECK(rc == BMEIPC_PARSE_ERROR || used == size);
+    return 0;
+  }
+  if (ev.size > 0)
+  {
+    data += used;
+    size -= used;
+    if (bmeipc_parse(&parser, data, size, &used, &ev) != BMEIPC_PARSE_DATA ||
+        !ev.last)
+    {
+      return 0;                 // cut short
+    }
+    CHECK(ev.data == data && ev.bytes <= BMEIPC_COOKIE_MAX);
+    payload = ev.data;
+    bytes = ev.bytes;
+  }
+
+  rc = bmeipc_cookie_check(payload, bytes, cookie);
+  CHECK((rc == 0) == (bytes == (int32_t) strlen(cookie) &&
+                      memcmp(payload, cookie, bytes) == 0));
+
+  ver = bmeipc_ack_version(payload, bytes);
+  CHECK(bytes == 1 ? ver == 1 || ver == 2 : ver == -1);
+  return 0;
+}
@@ -0,0 +1,159 @@
+/**
+   @file fuzz_frame.c
+
+   @brief libFuzzer target for the BME IPC framing parser
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * The first input byte picks a chunk size; the rest is a byte stream.
+ * The stream is split into frames with bmeipc_frame_decode() over the
+ * whole buffer, then fed to the incremental parser in chunks, and both
+ * must agree on every frame and on where the stream goes bad.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "bmeipc.h"
+#include "bmeframe.h"
+
+#define FUZZ_MAX_PAYLOAD 4096
+#define FUZZ_MAX_FRAMES 1024
+
+#define CHECK(cond) do { if (!(cond)) __builtin_trap(); } while (0)
+
+typedef struct
+{
+  bmeipc_frame_t frame;
+  size_t hdr;                   // offset of the header
+  size_t off;                   // offset of the payload
+  int32_t size;
+} ref_t;
+
+static ref_t ref[FUZZ_MAX_FRAMES];
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  bmeipc_parser_t parser;
+  bmeipc_parse_event_t ev;
+  size_t chunk, pos = 0, end, used;
+  int nref = 0, bad = 0, i = -1;
+  int32_t got = 0;
+  size_t off;
+
+  if (size < 1)
+  {
+    return 0;
+  }
+  chunk = data[0] % 32 + 1;
+  data++;
+  size--;
+
+  /* Reference: whole frames out of the whole buffer */
+  for (off = 0; nref < FUZZ_MAX_FRAMES;)
+  {
+    int32_t psize;
+    int32_t hlen = bmeipc_frame_decode(data + off, size - off,
+                                       FUZZ_MAX_PAYLOAD, &ref[nref].frame,
+                                       &psize);
+    if (hlen == -1)
+    {
+      bad = 1;
+      break;
+    }
+    if (hlen == 0)
+    {
+      break;
+    }
+    CHECK(hlen == 8 || hlen == BMEIPC_HEADER_MAX);
+    CHECK(psize >= 0 && psize <= FUZZ_MAX_PAYLOAD);
+    ref[nref].hdr = off;
+    ref[nref].off = off + hlen;
+    ref[nref].size = psize;
+    nref++;
+    if (size - off - hlen < (size_t) psize)
+    {
+      break;                    // payload cut short
+    }
+    off += hlen + psize;
+  }
+
+  /* Incremental, in chunks */
+  bmeipc_parser_init(&parser, FUZZ_MAX_PAYLOAD);
+  while (pos < size && i < FUZZ_MAX_FRAMES - 1)
+  {
+    int32_t rc;
+
+    end = pos + chunk < size ? pos + chunk : size;
+    rc = bmeipc_parse(&parser, data + pos, end - pos, &used, &ev);
+    CHECK(used <= end - pos);
+
+    switch (rc)
+    {
+    case BMEIPC_PARSE_ERROR:
+      CHECK(bad && i + 1 == nref);
+      CHECK(bmeipc_parse(&parser, data, size, &used, &ev) ==
+            BMEIPC_PARSE_ERROR);
+      return 0;
+
+    case BMEIPC_PARSE_MORE:
+      CHECK(used == end - pos);
+      break;
+
+    case BMEIPC_PARSE_HEADER:
+      i++;
+      CHECK(i < nref);
+      CHECK(got == 0);
+      CHECK(pos + used == ref[i].off);
+      CHECK(ev.size == ref[i].size);
+      CHECK(memcmp(&ev.frame, &ref[i].frame, sizeof ev.frame) == 0);
+      break;
+
+    case BMEIPC_PARSE_DATA:
+      CHECK(i >= 0 && used > 0);
+      CHECK((const uint8_t *)ev.data == data + pos);
+      CHECK(ev.bytes == (int32_t) used);
+      CHECK(pos == ref[i].off + got);
+      got += ev.bytes;
+      CHECK(got <= ref[i].size);
+      CHECK(!ev.last == (got < ref[i].size));
+      if (ev.last)
+      {
+        got = 0;
+      }
+      break;
+
+    default:
+      CHECK(0);
+    }
+    pos += used;
+  }
+
+  /* Every header the reference found was reported, and a bad one
+   * would have been an error above */
+  if (i < FUZZ_MAX_FRAMES - 1)
+  {
+    CHECK(!bad && i + 1 == nref);
+  }
+  return 0;
+}
@@ -0,0 +1,122 @@
+/**
+   @file bmearena.h
+
+   @brief Variable-length BME replies in a per-connection arena
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BMEARENA_H
+#define BMEARENA_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * An arena is a bump allocator that is emptied in one go. Keep one per
+ * connection and let bme_send_get_reply_arena() place each reply in
+ * it: the reply size is taken from the packet header, so callers need
+ * not guess it, and once the arena has grown to the largest reply seen
+ * no further allocation is made. Arenas are not thread safe.
+ */
+
+typedef struct bme_arena_s bme_arena_t;
+
+/**
+ * Create an arena
+ *
+ * @param size initial capacity in bytes; the arena grows on demand
+ *
+ * @return arena, NULL on error
+ *
+ * @ingroup bmeipc
+ */
+bme_arena_t *bme_arena_new(int32_t size);
+
+/**
+ * Free an arena and everything allocated from it
+ *
+ * @ingroup bmeipc
+ */
+void bme_arena_free(bme_arena_t *arena);
+
+/**
+ * Allocate from an arena
+ *
+ * @param arena arena
+ * @param bytes size, may be 0
+ *
+ * @return memory aligned for any type, valid until the next reset;
+ *         NULL on error
+ *
+ * @ingroup bmeipc
+ */
+void *bme_arena_alloc(bme_arena_t *arena, int32_t bytes);
+
+/**
+ * Release everything allocated from an arena, keeping its capacity
+ *
+ * @ingroup bmeipc
+ */
+void bme_arena_reset(bme_arena_t *arena);
+
+/**
+ * Receive a packet of any size into an arena
+ *
+ * Packets larger than BMEIPC_PAYLOAD_MAX are refused with errno
+ * EMSGSIZE, and the connection is shut down as described for
+ * bme_packet_read().
+ *
+ * @param fd socket descriptor
+ * @param arena arena to place the packet in
+ * @param msg packet data in @arena
+ *
+ * @return number of bytes read, -1 on error
+ *
+ * @ingroup bmeipc
+ */
+int32_t bme_packet_read_arena(int32_t fd, bme_arena_t *arena, void **msg);
+
+/**
+ * Send message to the server and get a reply of any size
+ *
+ * Resets @arena, then reads the reply into it as sized by the server.
+ *
+ * @param fd socket descriptor
+ * @param smsg address of a message to send
+ * @param sbytes size of message to send
+ * @param arena per-connection arena
+ * @param rmsg reply data in @arena, or NULL if the request has no reply
+ *             data
+ * @param rbytes size of reply data, or NULL
+ *
+ * @return server status, -1 on error
+ *
+ * @ingroup bmeipc
+ */
+int32_t bme_send_get_reply_arena(int32_t fd, const void *smsg,
+                                 int32_t sbytes, bme_arena_t *arena,
+                                 void **rmsg, int32_t *rbytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMEARENA_H */
@@ -0,0 +1,182 @@
+/**
+   @file bmeasync.h
+
+   @brief Non-blocking BME IPC connections
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BMEASYNC_H
+#define BMEASYNC_H
+
+#include <stdint.h>
+
+#include "bmeloop.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct bme_aconn_s bme_aconn_t;
+
+/* Reply timeout of new connections in milliseconds, as for blocking
+ * requests */
+#define BME_ACONN_TIMEOUT 5000
+
+/**
+ * Request completion callback
+ *
+ * @param conn connection
+ * @param status server status, -1 with errno set on failure; errno
+ *        is 0 when the server itself answered with a negative status
+ * @param data reply data, NULL if none
+ * @param bytes size of reply data
+ * @param user user data given with the request
+ */
+typedef void (*bme_reply_cb) (bme_aconn_t *conn, int32_t status,
+                              const void *data, int32_t bytes, void *user);
+
+/**
+ * Unsolicited packet callback
+ *
+ * Called for packets that do not answer a request, such as
+ * BME_INFO_IND. When the connection fails it is called once more with
+ * NULL data and -1 bytes.
+ */
+typedef void (*bme_packet_cb) (bme_aconn_t *conn, const void *data,
+                               int32_t bytes, void *user);
+
+/**
+ * Connect to a server and attach the connection to an event loop
+ *
+ * The handshake is done before returning; everything after it is
+ * non-blocking and driven by @loop. If the server advertises v2
+ * framing, requests carry IDs and may be answered out of order, and
+ * frames the server pushes go to the packet handler.
+ *
+ * @param loop event loop
+ * @param path socket path, NULL for BME_SRV_SOCK_PATH
+ * @param cookie handshake cookie, NULL for BME_SRV_COOKIE
+ *
+ * @return connection, NULL on error
+ *
+ * @ingroup bmeasync
+ */
+bme_aconn_t *bme_aconn_open(bme_loop_t *loop, const char *path,
+                            const char *cookie);
+
+/**
+ * Connect to a server without waiting for the handshake
+ *
+ * Like bme_aconn_open(), but the handshake completes from @loop.
+ * Requests may be queued at once; they go out behind the cookie and
+ * use v1 framing. A server that rejects the handshake fails them.
+ *
+ * @param loop event loop
+ * @param path socket path, NULL for BME_SRV_SOCK_PATH
+ * @param cookie handshake cookie, NULL for BME_SRV_COOKIE
+ *
+ * @return connection, NULL on error
+ *
+ * @ingroup bmeasync
+ */
+bme_aconn_t *bme_aconn_connect(bme_loop_t *loop, const char *path,
+                               const char *cookie);
+
+/**
+ * Close a connection
+ *
+ * Pending requests are dropped without calling their callbacks. Safe
+ * to call from any callback of the connection.
+ *
+ * @ingroup bmeasync
+ */
+void bme_aconn_close(bme_aconn_t *conn);
+
+/**
+ * Get the socket descriptor of a connection
+ *
+ * @ingroup bmeasync
+ */
+int32_t bme_aconn_fd(const bme_aconn_t *conn);
+
+/**
+ * Set how long the server may keep a reply waiting
+ *
+ * When a request, or the handshake of bme_aconn_connect(), has been
+ * waiting this long without the server answering anything, the
+ * connection fails with ETIMEDOUT: pending requests complete with -1.
+ * The wait starts over with each reply, so a pipeline is not failed
+ * while the server works through it.
+ *
+ * @param conn connection
+ * @param ms timeout in milliseconds, 0 to wait forever; the default
+ *        is BME_ACONN_TIMEOUT
+ *
+ * @ingroup bmeasync
+ */
+void bme_aconn_set_timeout(bme_aconn_t *conn, int32_t ms);
+
+/**
+ * Set the handler for unsolicited packets
+ *
+ * With v2 framing these are the frames the server pushes. v1 framing
+ * cannot mark them, so a packet that arrives while no request is
+ * pending, or that is not status sized while a status is awaited, is
+ * taken as unsolicited; indications are never status sized. Without a
+ * handler such packets are dropped.
+ *
+ * @ingroup bmeasync
+ */
+void bme_aconn_set_packet_handler(bme_aconn_t *conn, bme_packet_cb cb,
+                                  void *user);
+
+/**
+ * Queue a packet for sending
+ *
+ * @return 0 on success, -1 on error
+ *
+ * @ingroup bmeasync
+ */
+int32_t bme_aconn_send(bme_aconn_t *conn, const void *msg, int32_t bytes);
+
+/**
+ * Queue a request; the reply is delivered to @cb from the event loop
+ *
+ * Requests may be pipelined. With v1 framing replies complete in
+ * request order; with v2 framing in the order the server answers.
+ *
+ * @param conn connection
+ * @param msg message to send
+ * @param bytes size of message
+ * @param with_data nonzero if a non-negative status is followed by a
+ *        data packet, as for BME_SYSMSG_PROXY_GETTIME
+ * @param cb completion callback
+ * @param user user data for callback
+ *
+ * @return 0 on success, -1 on error
+ *
+ * @ingroup bmeasync
+ */
+int32_t bme_aconn_request(bme_aconn_t *conn, const void *msg, int32_t bytes,
+                          int32_t with_data, bme_reply_cb cb, void *user);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMEASYNC_H */
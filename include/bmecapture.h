@@ -0,0 +1,86 @@
+/**
+   @file bmecapture.h
+
+   @brief BME IPC traffic capture
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BMECAPTURE_H
+#define BMECAPTURE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BMECAP_MAGIC      0x50414342    /* "BCAP" */
+#define BMECAP_VERSION    1
+
+/* Record directions */
+#define BMECAP_WRITE      1             /* bme_packet_write() */
+#define BMECAP_READ       2             /* bme_packet_read() */
+
+/**
+ * Capture file header
+ */
+typedef struct bmecap_file_header_s
+{
+  uint32_t magic;               /* BMECAP_MAGIC */
+  uint32_t version;             /* BMECAP_VERSION */
+} bmecap_file_header_t;
+
+/**
+ * Capture record header, followed by @size bytes of packet payload
+ */
+typedef struct bmecap_record_s
+{
+  uint64_t usec;                /* monotonic time stamp */
+  int32_t fd;                   /* socket descriptor of the process */
+  uint16_t dir;                 /* BMECAP_WRITE or BMECAP_READ */
+  uint16_t reserved;
+  int32_t size;                 /* payload size */
+} bmecap_record_t;
+
+/**
+ * Start logging every framed packet to a file
+ *
+ * Capture is process wide and only ever started by this call.
+ *
+ * @param path capture file, created or truncated; not a symlink
+ *
+ * @return 0 on success, -1 on error
+ *
+ * @ingroup bmeipc
+ */
+int32_t bmeipc_capture_start(const char *path);
+
+/**
+ * Stop logging packets
+ *
+ * Must not be called while other threads are sending or receiving.
+ *
+ * @ingroup bmeipc
+ */
+void bmeipc_capture_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMECAPTURE_H */
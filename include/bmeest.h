@@ -0,0 +1,137 @@
+/**
+   @file bmeest.h
+
+   @brief Smoothed battery level, discharge rate and time left
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BMEEST_H
+#define BMEEST_H
+
+#include <stdint.h>
+
+#include "bmeipc.h"
+#include "bmemsg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The estimator fits a line to the battery level and to the voltage
+ * over time, weighting samples down exponentially with age. Adding a
+ * sample and querying are constant time and take no memory, so a
+ * caller can sample the server rarely and query as often as it draws.
+ * The fit restarts whenever the charger is connected or removed.
+ */
+
+/* Sample weight halves after this many seconds unless set otherwise */
+#define BMEEST_HALFLIFE 600
+
+/* Parts of bmeest_result_t that could be estimated */
+#define BMEEST_LEVEL        0x01 /* level */
+#define BMEEST_LEVEL_RATE   0x02 /* level_rate */
+#define BMEEST_VOLTAGE      0x04 /* voltage */
+#define BMEEST_VOLTAGE_RATE 0x08 /* voltage_rate */
+#define BMEEST_TIME_LEFT    0x10 /* time_left, while discharging */
+#define BMEEST_TIME_FULL    0x20 /* time_full, while charging */
+
+/** Estimate at a point in time */
+typedef struct bmeest_result_s
+{
+  uint32_t valid;               /* BMEEST_* bits */
+  int32_t charging;             /* charger connected at the last sample */
+  double level;                 /* bmestat_t BATTERY_LEVEL_PCT */
+  double level_rate;            /* percent per hour */
+  double voltage;               /* mV */
+  double voltage_rate;          /* mV per hour */
+  int32_t time_left;            /* minutes until empty */
+  int32_t time_full;            /* minutes until full */
+} bmeest_result_t;
+
+typedef struct bmeest_s bmeest_t;
+
+/**
+ * Create an estimator
+ *
+ * @param halflife seconds after which a sample counts half, 0 for
+ *        BMEEST_HALFLIFE; longer is smoother but slower to follow a
+ *        change in load
+ *
+ * @return estimator, NULL on error
+ *
+ * @ingroup bmeest
+ */
+bmeest_t *bmeest_new(int32_t halflife);
+
+/**
+ * Release an estimator
+ *
+ * @ingroup bmeest
+ */
+void bmeest_free(bmeest_t *est);
+
+/**
+ * Forget all samples
+ *
+ * @ingroup bmeest
+ */
+void bmeest_reset(bmeest_t *est);
+
+/**
+ * Add a sample
+ *
+ * Battery level and charger state are taken from @stat, voltage from
+ * @info when BME_BATTERY_VOLTAGE is set in the reply. Either source
+ * may be NULL.
+ *
+ * @param est estimator
+ * @param when sample time in seconds, must not go backwards
+ * @param stat statistics snapshot, or NULL
+ * @param info battery info reply, or NULL
+ *
+ * @return 0 on success, -1 on error
+ *
+ * @ingroup bmeest
+ */
+int32_t bmeest_add(bmeest_t *est, int64_t when, const bmestat_t *stat,
+                   const struct emsg_battery_info_reply *info);
+
+/**
+ * Estimate the battery state at a time
+ *
+ * Level and voltage are extrapolated from the last sample to @when
+ * along the fitted rate. Rates need samples spanning a minute or more;
+ * the time left also needs the level to be falling.
+ *
+ * @param est estimator
+ * @param when time in seconds, normally now
+ * @param res result, valid is 0 if nothing was sampled yet
+ *
+ * @return 0 on success, -1 on error
+ *
+ * @ingroup bmeest
+ */
+int32_t bmeest_query(const bmeest_t *est, int64_t when,
+                     bmeest_result_t *res);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMEEST_H */
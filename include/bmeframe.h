@@ -0,0 +1,169 @@
+/**
+   @file bmeframe.h
+
+   @brief BME IPC framing parser
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BMEFRAME_H
+#define BMEFRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bmeipc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The parser does no I/O and never allocates; it only looks at the
+ * bytes it is given. Whoever owns the socket - a blocking read, an
+ * event loop, a reader thread or a server - feeds it whatever has
+ * arrived and gets back frame headers and pointers to payload bytes
+ * inside its own buffer. The handshake packets that precede the first
+ * frame are checked the same way, once the parser has found them.
+ */
+
+/* Longest frame header (v2) */
+#define BMEIPC_HEADER_MAX 16
+
+/* Default payload limit of a parser */
+#define BMEIPC_PAYLOAD_MAX (1024 * 1024)
+
+/* Longest handshake cookie accepted */
+#define BMEIPC_COOKIE_MAX 64
+
+/**
+ * Decode a frame header at the start of a buffer
+ *
+ * @param buf received bytes
+ * @param len number of bytes at @buf
+ * @param max largest payload size accepted
+ * @param frame header fields, or NULL
+ * @param size payload size following the header
+ *
+ * @return header length when a whole header is present, 0 if more
+ *         bytes are needed, -1 with errno EBADMSG if the bytes are not
+ *         a valid header
+ *
+ * @ingroup bmeipc
+ */
+int32_t bmeipc_frame_decode(const void *buf, size_t len, int32_t max,
+                            bmeipc_frame_t *frame, int32_t *size);
+
+/* Parser results */
+enum
+{
+  BMEIPC_PARSE_ERROR = -1,      /* out of sync, errno EBADMSG */
+  BMEIPC_PARSE_MORE = 0,        /* input used up, nothing to report */
+  BMEIPC_PARSE_HEADER = 1,      /* a frame header is complete */
+  BMEIPC_PARSE_DATA = 2,        /* payload bytes of the current frame */
+};
+
+/**
+ * Incremental parser state; members are private
+ */
+typedef struct
+{
+  int32_t state;
+  int32_t max;
+  int32_t left;                 /* payload bytes still to come */
+  uint32_t have;                /* header bytes collected */
+  unsigned char head[BMEIPC_HEADER_MAX];
+} bmeipc_parser_t;
+
+/**
+ * What the parser found
+ */
+typedef struct
+{
+  bmeipc_frame_t frame;         /* HEADER: header fields */
+  int32_t size;                 /* HEADER: payload size */
+  const void *data;             /* DATA: payload bytes, inside the input */
+  int32_t bytes;                /* DATA: number of bytes at data */
+  int32_t last;                 /* DATA: nonzero if the frame is complete */
+} bmeipc_parse_event_t;
+
+/**
+ * Initialize a parser
+ *
+ * @param parser parser
+ * @param max largest payload size accepted, 0 for BMEIPC_PAYLOAD_MAX
+ *
+ * @ingroup bmeipc
+ */
+void bmeipc_parser_init(bmeipc_parser_t *parser, int32_t max);
+
+/**
+ * Parse received bytes up to the next event
+ *
+ * Call repeatedly, advancing the input by @used each time, until it
+ * returns BMEIPC_PARSE_MORE. Every frame is reported as a HEADER
+ * event followed by DATA events until one has last set; frames with
+ * an empty payload have no DATA events. Headers split across calls
+ * are collected in the parser; payload is never copied, so a payload
+ * split across calls is reported in pieces. After an error the parser
+ * must be initialized again.
+ *
+ * @param parser parser
+ * @param buf received bytes
+ * @param len number of bytes at @buf
+ * @param used number of bytes consumed
+ * @param ev event details
+ *
+ * @return BMEIPC_PARSE_* result
+ *
+ * @ingroup bmeipc
+ */
+int32_t bmeipc_parse(bmeipc_parser_t *parser, const void *buf, size_t len,
+                     size_t *used, bmeipc_parse_event_t *ev);
+
+/**
+ * Check the cookie packet that opens a connection
+ *
+ * @param data payload of the first packet the client sent
+ * @param bytes number of bytes at @data
+ * @param cookie expected cookie
+ *
+ * @return 0 if the packet is @cookie, -1 with errno EACCES if not, or
+ *         EINVAL if @cookie is longer than BMEIPC_COOKIE_MAX
+ *
+ * @ingroup bmeipc
+ */
+int32_t bmeipc_cookie_check(const void *data, int32_t bytes,
+                            const char *cookie);
+
+/**
+ * Framing version offered by the ack packet that answers a cookie
+ *
+ * @param data payload of the first packet the server sent
+ * @param bytes number of bytes at @data
+ *
+ * @return 1 or 2, -1 with errno EBADMSG if the packet is not an ack
+ *
+ * @ingroup bmeipc
+ */
+int32_t bmeipc_ack_version(const void *data, int32_t bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMEFRAME_H */
@@ -0,0 +1,147 @@
+/**
+   @file bmehist.h
+
+   @brief BME battery history recorder with rollup queries
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BMEHIST_H
+#define BMEHIST_H
+
+#include <stdint.h>
+
+#include "bmeipc.h"
+#include "bmemsg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Recorded quantities */
+enum bmehist_metric_e
+{
+  BMEHIST_LEVEL_PCT = 0,        /* bmestat_t BATTERY_LEVEL_PCT */
+  BMEHIST_VOLTAGE,              /* emsg_battery_info_reply voltage */
+  BMEHIST_TEMP,                 /* emsg_battery_info_reply temp */
+  BMEHIST_METRICS
+};
+
+/** Aggregate over a time range */
+typedef struct bmehist_result_s
+{
+  uint32_t count;               /* number of samples in range */
+  int32_t min;
+  int32_t max;
+  int64_t sum;
+  double avg;
+} bmehist_result_t;
+
+typedef struct bmehist_s bmehist_t;
+
+/**
+ * Create an empty history
+ *
+ * @return history, NULL on error
+ *
+ * @ingroup bmehist
+ */
+bmehist_t *bmehist_new(void);
+
+/**
+ * Release a history and all recorded samples
+ *
+ * @ingroup bmehist
+ */
+void bmehist_free(bmehist_t *hist);
+
+/**
+ * Limit how long raw samples are kept
+ *
+ * From the next sample on, raw samples older than @seconds are dropped
+ * a minute at a time; the minute, hour and day rollups keep them. A
+ * query that reaches back past the raw samples kept has its ends there
+ * widened to whole minutes. Zero, the default, keeps everything.
+ *
+ * @param hist history
+ * @param seconds raw sample lifetime, 0 for no limit
+ *
+ * @return 0 on success, -1 on error
+ *
+ * @ingroup bmehist
+ */
+int32_t bmehist_set_max_age(bmehist_t *hist, int64_t seconds);
+
+/**
+ * Record a sample
+ *
+ * Battery level is taken from @stat, voltage and temperature from
+ * @info when the corresponding BME_BATTERY_* flag is set in the reply.
+ * Either source may be NULL. The per-minute, per-hour and per-day
+ * rollups are updated as part of the call.
+ *
+ * @param hist history
+ * @param when sample time in seconds, must not go backwards
+ * @param stat statistics snapshot, or NULL
+ * @param info battery info reply, or NULL
+ *
+ * @return 0 on success, -1 on error
+ *
+ * @ingroup bmehist
+ */
+int32_t bmehist_add(bmehist_t *hist, int64_t when, const bmestat_t *stat,
+                    const struct emsg_battery_info_reply *info);
+
+/**
+ * Record a single value
+ *
+ * @param hist history
+ * @param when sample time in seconds, must not go backwards
+ * @param metric bmehist_metric_e
+ * @param value sample value
+ *
+ * @return 0 on success, -1 on error
+ *
+ * @ingroup bmehist
+ */
+int32_t bmehist_add_value(bmehist_t *hist, int64_t when, int32_t metric,
+                          int32_t value);
+
+/**
+ * Get min/max/avg of a metric over [from, to)
+ *
+ * Runs in O(log n) of the recorded history; only the samples in the
+ * partial minutes at either end of the range are visited directly.
+ *
+ * @param hist history
+ * @param metric bmehist_metric_e
+ * @param from start of range, inclusive
+ * @param to end of range, exclusive
+ * @param res result, count is 0 if no samples fall in the range
+ *
+ * @return 0 on success, -1 on error
+ *
+ * @ingroup bmehist
+ */
+int32_t bmehist_query(const bmehist_t *hist, int32_t metric,
+                      int64_t from, int64_t to, bmehist_result_t *res);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMEHIST_H */
@@ -0,0 +1,307 @@
+/**
+   @file bmeipc-coro.hpp
+
+   @brief BME IPC C++20 coroutine interface
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BMEIPC_CORO_HPP
+#define BMEIPC_CORO_HPP
+
+/*
+ * Awaitable BME requests on top of bmeasync.h, driven by bme_loop_t:
+ *
+ *   bme::co::detached poll(bme::co::Client &bme)
+ *   {
+ *     bme::stat_array s = co_await bme.stat();
+ *     auto info = co_await bme.battery_info(BME_BATTERY_VOLTAGE);
+ *   }
+ *
+ *   bme::co::Loop loop;
+ *   bme::co::Client bme(loop);
+ *   poll(bme);
+ *   loop.run();
+ *
+ * Awaiting suspends until the reply arrives; the coroutine is resumed
+ * from the event loop thread. Failures are thrown from co_await as
+ * std::system_error, including ETIMEDOUT when the server stops
+ * answering (see bme_aconn_set_timeout()). A Client must outlive the
+ * requests awaiting on it.
+ */
+
+#include <coroutine>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <optional>
+
+#include "bmeipc.hpp"
+#include "bmeloop.h"
+#include "bmeasync.h"
+
+namespace bme::co
+{
+
+/**
+ * Owner of a bme_loop_t
+ */
+class Loop
+{
+public:
+  Loop() : loop_(bme_loop_new())
+  {
+    if (!loop_)
+    {
+      throw_errno("bme_loop_new");
+    }
+  }
+  ~Loop() { bme_loop_free(loop_); }
+
+  Loop(const Loop &) = delete;
+  Loop &operator=(const Loop &) = delete;
+
+  bme_loop_t *get() const noexcept { return loop_; }
+
+  void run()
+  {
+    if (bme_loop_run(loop_) == -1)
+    {
+      throw_errno("bme_loop_run");
+    }
+  }
+  int32_t iterate(int32_t timeout_ms = -1) { return bme_loop_iterate(loop_, timeout_ms); }
+  void quit() noexcept { bme_loop_quit(loop_); }
+
+private:
+  bme_loop_t *loop_;
+};
+
+/**
+ * Fire-and-forget coroutine type; exceptions terminate
+ */
+struct detached
+{
+  struct promise_type
+  {
+    detached get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+
+/**
+ * Awaitable reply to a typed request
+ */
+template <class Req>
+class Reply
+{
+public:
+  using value_type = typename reply_for<Req>::type;
+
+  Reply(bme_aconn_t *conn, const Req &req) noexcept : conn_(conn), req_(req) {}
+
+  bool await_ready() const noexcept { return false; }
+
+  bool await_suspend(std::coroutine_handle<> h) noexcept
+  {
+    handle_ = h;
+    if (bme_aconn_request(conn_, &req_, sizeof(Req), 1, &Reply::done, this) == -1)
+    {
+      error_ = errno;
+      return false;
+    }
+    return true;
+  }
+
+  value_type await_resume()
+  {
+    if (error_)
+    {
+      throw std::system_error(error_, std::generic_category(), "bme request");
+    }
+    return value_;
+  }
+
+private:
+  static void done(bme_aconn_t *, int32_t status, const void *data,
+                   int32_t bytes, void *user)
+  {
+    Reply *self = static_cast<Reply *>(user);
+
+    if (status < 0)
+    {
+      self->error_ = errno ? errno : EIO;
+    }
+    else if (bytes != static_cast<int32_t>(sizeof(value_type)))
+    {
+      self->error_ = EBADMSG;
+    }
+    else
+    {
+      std::memcpy(&self->value_, data, sizeof(value_type));
+    }
+    self->handle_.resume();
+  }
+
+  bme_aconn_t *conn_;
+  Req req_;
+  value_type value_{};
+  int error_ = 0;
+  std::coroutine_handle<> handle_;
+};
+
+/**
+ * Non-blocking request/reply connection
+ */
+class Client
+{
+public:
+  explicit Client(Loop &loop, const char *path = BME_SRV_SOCK_PATH)
+    : conn_(bme_aconn_open(loop.get(), path, BME_SRV_COOKIE))
+  {
+    if (!conn_)
+    {
+      throw_errno("bme_aconn_open");
+    }
+  }
+  ~Client() { bme_aconn_close(conn_); }
+
+  Client(const Client &) = delete;
+  Client &operator=(const Client &) = delete;
+
+  bme_aconn_t *get() const noexcept { return conn_; }
+
+  template <class Req>
+  Reply<Req> request(const Req &req) noexcept
+  {
+    static_assert(is_wire_type_v<Req>, "request must be a plain wire struct");
+    return Reply<Req>(conn_, req);
+  }
+
+  Reply<sysmsg<BME_SYSMSG_PROXY_GETTIME>> stat() noexcept
+  {
+    return request(sysmsg<BME_SYSMSG_PROXY_GETTIME>{});
+  }
+
+  Reply<sysmsg<BME_SYSMSG_GETPID>> server_pid() noexcept
+  {
+    return request(sysmsg<BME_SYSMSG_GETPID>{});
+  }
+
+  Reply<emsg_battery_info_req> battery_info(uint32_t flags) noexcept
+  {
+    return request(emsg_battery_info_req{ BME_BATTERY_INFO_REQ, 0, flags });
+  }
+
+private:
+  bme_aconn_t *conn_;
+};
+
+/**
+ * Stream of BME_INFO_IND indications from an indication channel
+ *
+ *   for (;;) { emsg_info_ind ind = co_await stream.next(); ... }
+ *
+ * Indications that arrive while nobody awaits are queued.
+ */
+class IndicationStream
+{
+public:
+  class Next
+  {
+  public:
+    explicit Next(IndicationStream &s) noexcept : s_(s) {}
+
+    bool await_ready() const noexcept { return !s_.queue_.empty() || s_.error_; }
+    void await_suspend(std::coroutine_handle<> h) noexcept { s_.waiter_ = h; }
+
+    emsg_info_ind await_resume()
+    {
+      if (s_.queue_.empty())
+      {
+        throw std::system_error(s_.error_, std::generic_category(),
+                                "bme indication stream");
+      }
+      emsg_info_ind ind = s_.queue_.front();
+      s_.queue_.pop_front();
+      return ind;
+    }
+
+  private:
+    IndicationStream &s_;
+  };
+
+  IndicationStream(Loop &loop, const char *cookie,
+                   const char *path = BME_SRV_SOCK_PATH)
+    : conn_(bme_aconn_open(loop.get(), path, cookie))
+  {
+    if (!conn_)
+    {
+      throw_errno("bme_aconn_open");
+    }
+    bme_aconn_set_packet_handler(conn_, &IndicationStream::packet, this);
+  }
+  ~IndicationStream() { bme_aconn_close(conn_); }
+
+  IndicationStream(const IndicationStream &) = delete;
+  IndicationStream &operator=(const IndicationStream &) = delete;
+
+  /** Await the next indication; only one coroutine may await at a time */
+  Next next() noexcept { return Next(*this); }
+
+private:
+  static void packet(bme_aconn_t *, const void *data, int32_t bytes, void *user)
+  {
+    IndicationStream *self = static_cast<IndicationStream *>(user);
+
+    if (bytes < 0)
+    {
+      self->error_ = errno ? errno : ECONNRESET;
+    }
+    else if (bytes >= static_cast<int32_t>(sizeof(emsg_info_ind)))
+    {
+      emsg_info_ind ind;
+      std::memcpy(&ind, data, sizeof ind);
+      if (ind.type != BME_INFO_IND)
+      {
+        return;
+      }
+      self->queue_.push_back(ind);
+    }
+    else
+    {
+      return;
+    }
+
+    if (self->waiter_)
+    {
+      std::exchange(self->waiter_, nullptr).resume();
+    }
+  }
+
+  bme_aconn_t *conn_;
+  std::deque<emsg_info_ind> queue_;
+  std::coroutine_handle<> waiter_;
+  int error_ = 0;
+};
+
+} // namespace bme::co
+
+#endif /* BMEIPC_CORO_HPP */
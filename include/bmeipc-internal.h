@@ -27,6 +27,46 @@
 #define BMEIPC_INTERNAL_H
 
 #include <stdint.h>
+#include <sys/time.h>
+#include <sys/syslog.h>
+
+#include "bmeframe.h"
+
+/**
+ * BME packet header structure
+ */
+typedef struct
+{
+  int sync;                     // sync pattern for detecting broken packets
+  int size;                     // size of actual packet data after the header
+} bmeipc_header;
+
+/**
+ * Sync pattern for packet header
+ */
+#define BMEIPC_SYNCWORD 0x434e5953
+
+/**
+ * BME v2 packet header structure, negotiated at handshake
+ */
+typedef struct
+{
+  bmeipc_header base;           // sync is BMEIPC_SYNCWORD_V2
+  uint32_t reqid;               // request ID, echoed in the reply
+  uint16_t type;                // message type
+  uint16_t flags;               // BMEIPC_F_*
+} bmeipc_header_v2;
+
+/**
+ * Sync pattern for v2 packet header
+ */
+#define BMEIPC_SYNCWORD_V2 0x32435953
+
+/**
+ * Handshake ack bytes; the v1 ack predates versioning
+ */
+#define BMEIPC_ACK_V1 "\n"
+#define BMEIPC_ACK_V2 "2"
 
 /**
  * Read BME cookie
@@ -38,6 +78,17 @@
  */
 int32_t _bme_cookie_read(int32_t fd, const char *cookie);
 
+/**
+ * Read BME cookie and advertise a framing version
+ *
+ * @param fd socket descriptor to receive cookie from
+ * @param cookie cookie
+ * @param maxver highest framing version the server speaks, 1 or 2
+ *
+ * @return  0 on success, -1 on error
+ */
+int32_t _bme_cookie_read_ver(int32_t fd, const char *cookie, int32_t maxver);
+
 /**
  * Write BME cookie
  *
@@ -48,4 +99,132 @@ int32_t _bme_cookie_read(int32_t fd, const char *cookie);
  */
 int32_t _bme_cookie_write(int32_t fd, const char *cookie);
 
+/**
+ * Write BME cookie and learn the framing version of the server
+ *
+ * @param fd socket descriptor to send cookie to
+ * @param cookie cookie
+ * @param version set to the highest version the server speaks, or NULL
+ *
+ * @return  0 on success, -1 on error
+ */
+int32_t _bme_cookie_write_ver(int32_t fd, const char *cookie,
+                              int32_t *version);
+
+/**
+ * Receive buffer of a non-blocking reader, collecting whole frames
+ */
+typedef struct
+{
+  bmeipc_parser_t parser;
+  char *buf;
+  size_t len, cap;
+  size_t off;                   // bytes given to the parser
+  size_t start;                 // payload offset of the current frame
+  int collecting;               // payload of the current frame incomplete
+  bmeipc_frame_t frame;
+  int32_t size;
+} bmeipc_rx_t;
+
+/**
+ * Set up a receive buffer
+ *
+ * @param rx receive buffer
+ * @param cap initial size, grown as frames need
+ * @param max largest payload size accepted
+ *
+ * @return 0 on success, -1 on error
+ */
+int32_t _bme_rx_init(bmeipc_rx_t *rx, size_t cap, int32_t max);
+
+/**
+ * Release a receive buffer
+ */
+void _bme_rx_free(bmeipc_rx_t *rx);
+
+/**
+ * Make room to receive into, at least @min bytes and enough for the
+ * frame being collected; received bytes are then added to rx->len
+ *
+ * @param rx receive buffer
+ * @param min bytes wanted
+ * @param room set to the free space
+ *
+ * @return free space, NULL if out of memory
+ */
+char *_bme_rx_space(bmeipc_rx_t *rx, size_t min, size_t *room);
+
+/**
+ * Get the next complete frame
+ *
+ * The payload stays in the buffer until _bme_rx_compact() and moves
+ * if _bme_rx_space() grows it.
+ *
+ * @param rx receive buffer
+ * @param frame header fields
+ * @param data payload
+ * @param size payload size
+ *
+ * @return 1 if a frame was found, 0 if more bytes are needed, -1 with
+ *         errno EBADMSG if the stream is out of sync
+ */
+int32_t _bme_rx_next(bmeipc_rx_t *rx, bmeipc_frame_t *frame, char **data,
+                     int32_t *size);
+
+/**
+ * Drop the bytes of the frames returned so far
+ */
+void _bme_rx_compact(bmeipc_rx_t *rx);
+
+/**
+ * Get time stamp that is not affected by system time changes
+ *
+ * @param tv time stamp
+ */
+void _bme_getmonotime(struct timeval *tv);
+
+/**
+ * Set timeout given milliseconds in to future
+ *
+ * @param timeout time stamp to set
+ * @param msec milliseconds from now
+ */
+void _bme_settimeout(struct timeval *timeout, int msec);
+
+/**
+ * Return milliseconds left to timeout
+ *
+ * @param timeout time stamp set with _bme_settimeout()
+ *
+ * @return milliseconds left, 0 if already expired
+ */
+int _bme_msecsto(const struct timeval *timeout);
+
+/**
+ * Error diagnostics output
+ *
+ * Note: The errno value will not be modified by this function.
+ *
+ * @param level syslog level constant (LOG_WARNING etc)
+ * @param fmt printf style format string
+ */
+void _bme_log_message(int level, const char *fmt, ...)
+  __attribute__ ((format(printf, 2, 3)));
+
+/**
+ * Log a framed packet to the capture file, if capturing
+ *
+ * @param fd socket descriptor
+ * @param dir BMECAP_WRITE or BMECAP_READ
+ * @param msg packet payload
+ * @param bytes payload size
+ */
+void _bme_capture(int fd, int dir, const void *msg, int bytes);
+
+#define log_warn_F(FMT, ARG...)\
+    _bme_log_message(LOG_WARNING, "%s: "FMT, __FUNCTION__, ## ARG)
+
+#define log_error_F(FMT, ARG...)\
+    _bme_log_message(LOG_ERR, "%s: "FMT, __FUNCTION__, ## ARG)
+
 #endif /* BMEIPC_INTERNAL_H */
@@ -0,0 +1,104 @@
+/**
+   @file bmeipc-probes.h
+
+   @brief BME IPC static tracing probes
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BMEIPC_PROBES_H
+#define BMEIPC_PROBES_H
+
+/*
+ * USDT probes under provider "bmeipc", usable with perf, bpftrace or
+ * systemtap, e.g.
+ *
+ *   bpftrace -e 'usdt:/usr/lib/libopenbmeipc.so:bmeipc:poll_timeout
+ *                { printf("fd %d\n", arg0); }'
+ *
+ * An unattached probe is a single nop. Probes compile away entirely
+ * when <sys/sdt.h> is not available or --disable-sdt is given.
+ *
+ *   packet_write_entry    fd, type, bytes
+ *   packet_write_return   fd, type, result
+ *   header_read_entry     fd
+ *   header_read_return    fd, result
+ *   bytes_read_entry      fd, bytes
+ *   bytes_read_return     fd, bytes, result
+ *   send_get_reply_entry  fd, type, sbytes, rbytes
+ *   send_get_reply_return fd, type, status, reply bytes
+ *   poll_timeout          fd, msec
+ *   spin_miss             fd, usec
+ *   sync_error            fd, sync word, size
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+/* Every probe, for its semaphore */
+#define BME_PROBE_NAMES(X) \
+  X(packet_write_entry) X(packet_write_return) \
+  X(header_read_entry) X(header_read_return) \
+  X(bytes_read_entry) X(bytes_read_return) \
+  X(send_get_reply_entry) X(send_get_reply_return) \
+  X(poll_timeout) X(spin_miss) X(sync_error)
+
+#ifdef HAVE_SYS_SDT_H
+/* Tracers count themselves into a semaphore per probe on attaching,
+ * so that arguments are only worked out while someone is listening;
+ * the semaphores are defined in bmeipc.c */
+# define _SDT_HAS_SEMAPHORES 1
+# include <sys/sdt.h>
+# define BME_PROBE_SEMAPHORE(name) bmeipc_##name##_semaphore
+# define BME_PROBE_DECLARE(name) \
+  extern unsigned short BME_PROBE_SEMAPHORE(name);
+BME_PROBE_NAMES(BME_PROBE_DECLARE)
+# define BME_PROBE_ENABLED(name) \
+  __builtin_expect(BME_PROBE_SEMAPHORE(name) != 0, 0)
+# define BME_PROBE1(name, a)          DTRACE_PROBE1(bmeipc, name, a)
+# define BME_PROBE2(name, a, b)       DTRACE_PROBE2(bmeipc, name, a, b)
+# define BME_PROBE3(name, a, b, c)    DTRACE_PROBE3(bmeipc, name, a, b, c)
+# define BME_PROBE4(name, a, b, c, d) DTRACE_PROBE4(bmeipc, name, a, b, c, d)
+#else
+# define BME_PROBE_ENABLED(name)      0
+# define BME_PROBE1(name, a)          do { } while (0)
+# define BME_PROBE2(name, a, b)       do { } while (0)
+# define BME_PROBE3(name, a, b, c)    do { } while (0)
+# define BME_PROBE4(name, a, b, c, d) do { } while (0)
+#endif
+
+static inline int
+bme_probe_type(const void *msg, int bytes)
+{
+  uint16_t type;
+
+  if (bytes < (int)sizeof type)
+  {
+    return -1;
+  }
+  memcpy(&type, msg, sizeof type);      // msg may be unaligned
+  return type;
+}
+
+/**
+ * Message type of a packet payload for arguments of probe @name, read
+ * only while the probe is attached
+ */
+#define BME_PROBE_TYPE(name, msg, bytes) \
+  (BME_PROBE_ENABLED(name) ? bme_probe_type(msg, bytes) : -1)
+
+#endif /* BMEIPC_PROBES_H */
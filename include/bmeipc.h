@@ -28,6 +28,10 @@
 
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define BME_SRV_SOCK_PATH "/tmp/.bmesrv"
 #define BME_SRV_COOKIE    "BMentity"
 
@@ -35,9 +39,12 @@
 enum bme_sysmsg_e
 {
   BME_SYSMSG_GETPID = 0x8000,   /* beyond ISI reuests range */
-  BME_SYSMSG_PROXY_OPEN,
-  BME_SYSMSG_PROXY_CLOSE,
-  BME_SYSMSG_PROXY_GETTIME      /* 0x8003 get bme statistics */
+  BME_SYSMSG_PROXY_OPEN,        /* 0x8001 bmeproxy: reply bmeipc_pid_t of proxy */
+  BME_SYSMSG_PROXY_CLOSE,       /* 0x8002 bmeproxy: status only, then hang up */
+  BME_SYSMSG_PROXY_GETTIME,     /* 0x8003 get bme statistics */
+  BME_SYSMSG_PROXY_GETTIME_DELTA, /* 0x8004 changed statistics, see bmestat.h */
+  BME_SYSMSG_FULL_STATE         /* 0x8005 statistics, battery info and last
+                                 * info indication, see bmestate.h */
 };
 
 /* for BME_SYSMSG_PROXY_GETTIME replies */
@@ -58,7 +65,8 @@ int32_t bmeipc_stat(int32_t sd, bmestat_t *stat);
 
 /* NB! these values are not absolute. they may be wrong, as they were gathered
  * by sending a BME_SYSMSG_PROXY_GETTIME and making an awful lot of guesswork
- * based on the values returned. You have been warned. YMMV. */
+ * based on the values returned. You have been warned. YMMV.
+ * bmeest.h smooths the level and estimates the time left on the client. */
 
 /* offset inside bmestat_t to look for charger state */
 #define CHARGER_STATE 1
@@ -105,6 +113,12 @@ typedef struct bmeipc_pid_s
 /**
  * Receive BME data from socket
  *
+ * A packet larger than @bytes fails the call with errno EBADMSG. Up
+ * to BMEIPC_PAYLOAD_MAX (bmeframe.h) bytes it is read and thrown away
+ * and the connection stays usable. A larger one, or one that cannot be
+ * read in full, leaves the stream out of step, so the connection is
+ * shut down: later reads return EOF and writes fail.
+ *
  * @param fd socket descriptor
  * @param msg data address
  * @param bytes data size
@@ -116,6 +130,96 @@ typedef struct bmeipc_pid_s
 int32_t bme_packet_read(int32_t fd, void *msg, int32_t bytes);
 int32_t bme_read(int32_t fd, void *msg, int32_t bytes);
 
+/**
+ * Select spin-then-block reads for one connection
+ *
+ * Blocking reads on @fd first busy-poll the socket for up to @usec
+ * microseconds before sleeping in poll(). Worth it when the server is
+ * local and replies in microseconds; costs a busy CPU for up to @usec
+ * per read otherwise. Zero, the default, always sleeps. Ignored on
+ * single CPU systems. Only a handful of connections per process can
+ * spin; the setting is dropped by bmeipc_close(), so close such a
+ * connection with it or set zero first.
+ *
+ * @param fd socket descriptor
+ * @param usec spin time in microseconds
+ *
+ * @return previous spin time of @fd, -1 on error
+ *
+ * @ingroup bmeipc
+ */
+int32_t bmeipc_set_read_spin(int32_t fd, int32_t usec);
+
+/* v2 frame flags */
+#define BMEIPC_F_REPLY  0x0001  /* answers the request with the same reqid;
+                                 * payload is int32_t status + reply data */
+#define BMEIPC_F_PUSH   0x0002  /* sent by the server unasked, only to
+                                 * clients that have sent v2 frames */
+
+/**
+ * Packet header fields
+ *
+ * v2 headers are used only after the server has advertised them in
+ * the handshake and the client has chosen to send v2 frames. A v2
+ * server answers each request in the framing it arrived in, so v1
+ * peers keep working unchanged.
+ */
+typedef struct bmeipc_frame_s
+{
+  uint32_t version;             /* 1 or 2 */
+  uint32_t reqid;               /* v2: request ID, echoed in the reply */
+  uint16_t type;                /* v2: message type */
+  uint16_t flags;               /* v2: BMEIPC_F_* */
+} bmeipc_frame_t;
+
+/**
+ * Receive BME data and its header fields from socket
+ *
+ * Accepts both v1 and v2 framing; for v1 packets only version is set.
+ *
+ * @param fd socket descriptor
+ * @param frame header fields of the packet
+ * @param msg data address
+ * @param bytes data size
+ *
+ * @return number of bytes read, -1 on error
+ *
+ * @ingroup bmeipc
+ */
+int32_t bme_frame_read(int32_t fd, bmeipc_frame_t *frame, void *msg,
+                       int32_t bytes);
+
+/**
+ * Send BME data with header fields to socket
+ *
+ * @param fd socket descriptor
+ * @param frame header fields; NULL or version 1 writes a v1 header
+ * @param msg data address
+ * @param bytes data size
+ *
+ * @return number of bytes send, -1 on error
+ *
+ * @ingroup bmeipc
+ */
+int32_t bme_frame_write(int32_t fd, const bmeipc_frame_t *frame,
+                        const void *msg, int32_t bytes);
+
+/**
+ * Answer a request in the framing it arrived in (server side)
+ *
+ * @param fd socket descriptor
+ * @param req header fields of the request, from bme_frame_read()
+ * @param status status word, negative for failure
+ * @param data reply data, or NULL for a status-only reply
+ * @param bytes size of reply data
+ *
+ * @return 0 on success, -1 on error
+ *
+ * @ingroup bmeipc
+ */
+int32_t bme_reply_write(int32_t fd, const bmeipc_frame_t *req, int32_t status,
+                        const void *data, int32_t bytes);
+
 /**
  * Send BME data to socket.
  *
@@ -148,6 +252,17 @@ void bmeipc_close(int32_t sd);
  */
 int32_t bmeipc_open(void);
 
+/**
+ * Open connection to a BME compatible server on a given socket path
+ *
+ * @param path unix socket path, BME_SRV_SOCK_PATH for the BME server
+ *
+ * @ingroup bmeipc
+ *
+ * @return socket descriptor on success, -1 on error
+ */
+int32_t bmeipc_open_path(const char *path);
+
 /* -------------------- BME messaging primitives -------------------- */
 
 /** Send message to the server and get reply
@@ -182,4 +297,8 @@ int32_t bmeipc_eopen(int mask);
 void bmeipc_eclose(int32_t sd);
 
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* BMEIPC_H */
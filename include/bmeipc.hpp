@@ -0,0 +1,302 @@
+/**
+   @file bmeipc.hpp
+
+   @brief BME IPC C++ interface
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BMEIPC_HPP
+#define BMEIPC_HPP
+
+/*
+ * Header-only wrapper over bmeipc.h and bmemsg.h, C++17 or later.
+ *
+ *   bme::Connection c = bme::Connection::open();
+ *   bme::stat_array s = c.stat();
+ *   auto info = c.battery_info<BME_BATTERY_VOLTAGE | BME_BATTERY_TEMP>();
+ *
+ * Requests and replies are plain wire structs paired at compile time
+ * through bme::reply_for, so an exchange is a single
+ * bme_send_get_reply() call with constant sizes. Calls that return a
+ * value throw std::system_error on failure; request() keeps the C
+ * convention of returning the server status.
+ */
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#if __cplusplus >= 202002L && __has_include(<span>)
+#include <span>
+#endif
+
+#include "bmeipc.h"
+#include "bmemsg.h"
+
+namespace bme
+{
+
+#if __cplusplus >= 202002L && __has_include(<span>)
+template <class T>
+using span = std::span<T>;
+#else
+/** Minimal stand-in for std::span before C++20 */
+template <class T>
+class span
+{
+public:
+  constexpr span() noexcept = default;
+  constexpr span(T *data, std::size_t size) noexcept : data_(data), size_(size) {}
+  template <std::size_t N>
+  constexpr span(T (&arr)[N]) noexcept : data_(arr), size_(N) {}
+  template <class C, class = decltype(std::declval<C &>().data())>
+  constexpr span(C &c) noexcept : data_(c.data()), size_(c.size()) {}
+
+  constexpr T *data() const noexcept { return data_; }
+  constexpr std::size_t size() const noexcept { return size_; }
+  constexpr std::size_t size_bytes() const noexcept { return size_ * sizeof(T); }
+
+private:
+  T *data_ = nullptr;
+  std::size_t size_ = 0;
+};
+#endif
+
+/** bmestat_t as a value type */
+using stat_array = std::array<int32_t, BME_LAST_STAT_IDX>;
+static_assert(sizeof(stat_array) == sizeof(bmestat_t), "bmestat_t layout");
+
+/** Every BME_BATTERY_* flag */
+constexpr uint32_t battery_flags_all =
+  BME_BATTERY_TYPE | BME_BATTERY_NOMINAL_CAPA | BME_BATTERY_TEMP |
+  BME_BATTERY_VOLTAGE | BME_BATTERY_VOLTAGE_TX_ON |
+  BME_BATTERY_VOLTAGE_TX_OFF | BME_BATTERY_VOLTAGE_PWM_ON |
+  BME_BATTERY_VOLTAGE_PWM_OFF | BME_BATTERY_GENERATION |
+  BME_BATTERY_VOLTAGE_SH_CHK;
+
+/** System message with a fixed code, see bme_sysmsg_e */
+template <uint16_t Code>
+struct sysmsg
+{
+  bmeipc_msg_t msg = { Code, 0 };
+};
+
+/**
+ * Reply type and message ID of a request type
+ *
+ * Specialise to teach request() about new messages.
+ */
+template <class Req>
+struct reply_for;
+
+template <>
+struct reply_for<sysmsg<BME_SYSMSG_GETPID>>
+{
+  using type = bmeipc_pid_t;
+  static constexpr uint16_t id = BME_SYSMSG_GETPID;
+};
+
+template <>
+struct reply_for<sysmsg<BME_SYSMSG_PROXY_GETTIME>>
+{
+  using type = stat_array;
+  static constexpr uint16_t id = BME_SYSMSG_PROXY_GETTIME;
+};
+
+template <>
+struct reply_for<emsg_battery_info_req>
+{
+  using type = emsg_battery_info_reply;
+  static constexpr uint16_t id = BME_BATTERY_INFO_REQ;
+};
+
+/** Can a type go over the wire as is */
+template <class T>
+constexpr bool is_wire_type_v =
+  std::is_trivially_copyable_v<T> && std::is_standard_layout_v<T>;
+
+static_assert(sizeof(emsg_battery_info_req) == 8, "wire layout");
+static_assert(sizeof(emsg_battery_info_reply) == 32, "wire layout");
+static_assert(sizeof(emsg_info_ind) == 20, "wire layout");
+static_assert(sizeof(bmeipc_pid_t) == 8, "wire layout");
+static_assert(sizeof(sysmsg<0>) == sizeof(bmeipc_msg_t), "wire layout");
+
+/**
+ * Battery info request for a flag mask checked at compile time
+ */
+template <uint32_t Flags>
+constexpr emsg_battery_info_req
+battery_info_request() noexcept
+{
+  static_assert(Flags != 0, "no BME_BATTERY_* flag given");
+  static_assert((Flags & ~battery_flags_all) == 0, "unknown BME_BATTERY_* flag");
+  return emsg_battery_info_req{ reply_for<emsg_battery_info_req>::id, 0, Flags };
+}
+
+[[noreturn]] inline void
+throw_errno(const char *what)
+{
+  throw std::system_error(errno ? errno : EIO, std::generic_category(), what);
+}
+
+/**
+ * Move-only owner of a BME server connection
+ */
+class Connection
+{
+public:
+  Connection() noexcept = default;
+
+  /** Take ownership of a descriptor from bmeipc_open() */
+  explicit Connection(int32_t fd) noexcept : fd_(fd) {}
+
+  ~Connection() { reset(); }
+
+  Connection(Connection &&other) noexcept : fd_(std::exchange(other.fd_, -1)) {}
+
+  Connection &operator=(Connection &&other) noexcept
+  {
+    if (this != &other)
+    {
+      reset(std::exchange(other.fd_, -1));
+    }
+    return *this;
+  }
+
+  Connection(const Connection &) = delete;
+  Connection &operator=(const Connection &) = delete;
+
+  static Connection open()
+  {
+    return open(BME_SRV_SOCK_PATH);
+  }
+
+  static Connection open(const char *path)
+  {
+    int32_t fd = bmeipc_open_path(path);
+    if (fd == -1)
+    {
+      throw_errno("bmeipc_open");
+    }
+    return Connection(fd);
+  }
+
+  int32_t fd() const noexcept { return fd_; }
+  explicit operator bool() const noexcept { return fd_ != -1; }
+
+  /** Give up ownership of the descriptor */
+  int32_t release() noexcept { return std::exchange(fd_, -1); }
+
+  void reset(int32_t fd = -1) noexcept
+  {
+    if (fd_ != -1)
+    {
+      bmeipc_close(fd_);
+    }
+    fd_ = fd;
+  }
+
+  /** Send one packet */
+  void send(span<const std::byte> msg)
+  {
+    int32_t n = static_cast<int32_t>(msg.size_bytes());
+    if (bme_packet_write(fd_, msg.data(), n) != n)
+    {
+      throw_errno("bme_packet_write");
+    }
+  }
+
+  /**
+   * Receive one packet
+   *
+   * @return payload size, 0 on EOF
+   */
+  std::size_t receive(span<std::byte> buf)
+  {
+    int32_t n = bme_packet_read(fd_, buf.data(),
+                                static_cast<int32_t>(buf.size_bytes()));
+    if (n == -1)
+    {
+      throw_errno("bme_packet_read");
+    }
+    return static_cast<std::size_t>(n);
+  }
+
+  /**
+   * Send a typed request and read its typed reply
+   *
+   * @return server status, -1 on error; @rep is valid if >= 0
+   */
+  template <class Req, class Rep = typename reply_for<Req>::type>
+  int32_t request(const Req &req, Rep &rep) noexcept
+  {
+    static_assert(std::is_same_v<Rep, typename reply_for<Req>::type>,
+                  "reply type does not match request");
+    static_assert(is_wire_type_v<Req> && is_wire_type_v<Rep>,
+                  "request and reply must be plain wire structs");
+
+    int32_t got = 0;
+    int32_t status = bme_send_get_reply(fd_, &req, sizeof(Req),
+                                        &rep, sizeof(Rep), &got);
+    if (status >= 0 && got != static_cast<int32_t>(sizeof(Rep)))
+    {
+      errno = EBADMSG;
+      return -1;
+    }
+    return status;
+  }
+
+  /** Send a typed request, throw unless the server accepts it */
+  template <class Req>
+  typename reply_for<Req>::type call(const Req &req)
+  {
+    typename reply_for<Req>::type rep;
+    if (request(req, rep) < 0)
+    {
+      throw_errno("bme_send_get_reply");
+    }
+    return rep;
+  }
+
+  stat_array stat()
+  {
+    return call(sysmsg<BME_SYSMSG_PROXY_GETTIME>{});
+  }
+
+  uint32_t server_pid()
+  {
+    return call(sysmsg<BME_SYSMSG_GETPID>{}).pid;
+  }
+
+  template <uint32_t Flags>
+  emsg_battery_info_reply battery_info()
+  {
+    return call(battery_info_request<Flags>());
+  }
+
+private:
+  int32_t fd_ = -1;
+};
+
+} // namespace bme
+
+#endif /* BMEIPC_HPP */
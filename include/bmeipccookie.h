@@ -28,6 +28,10 @@
 
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * Read BME cookie
  *
@@ -48,4 +52,34 @@ int32_t bme_cookie_read(int32_t fd, const char *cookie);
  */
 int32_t bme_cookie_write(int32_t fd, const char *cookie);
 
+/**
+ * Read BME cookie, offering framing versions up to @maxver
+ *
+ * The handshake reply depends on @maxver alone: with 2 or more every
+ * client is sent the v2 ack. Older clients still work because they
+ * only wait for the ack byte and ignore its value.
+ *
+ * @param fd socket descriptor to receive cookie from
+ * @param cookie cookie
+ * @param maxver highest framing version the server accepts
+ *
+ * @return  0 on success, -1 on error
+ */
+int32_t bme_cookie_read_ver(int32_t fd, const char *cookie, int32_t maxver);
+
+/**
+ * Write BME cookie and learn the framing version of the server
+ *
+ * @param fd socket descriptor to send cookie to
+ * @param cookie cookie
+ * @param version where to store the negotiated version, may be NULL
+ *
+ * @return  0 on success, -1 on error
+ */
+int32_t bme_cookie_write_ver(int32_t fd, const char *cookie, int32_t *version);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* BMEIPCCOOKIE_H */
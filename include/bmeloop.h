@@ -0,0 +1,134 @@
+/**
+   @file bmeloop.h
+
+   @brief Minimal epoll event loop for asynchronous BME IPC
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BMELOOP_H
+#define BMELOOP_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct bme_loop_s bme_loop_t;
+
+/**
+ * Descriptor event callback
+ *
+ * @param loop loop the descriptor is watched by
+ * @param fd descriptor
+ * @param events EPOLLIN, EPOLLOUT, ... as reported by epoll
+ * @param data user data given to bme_loop_add()
+ */
+typedef void (*bme_loop_cb) (bme_loop_t *loop, int32_t fd, uint32_t events,
+                             void *data);
+
+/**
+ * Create an event loop
+ *
+ * @return loop, NULL on error
+ *
+ * @ingroup bmeloop
+ */
+bme_loop_t *bme_loop_new(void);
+
+/**
+ * Destroy an event loop; watched descriptors are not closed
+ *
+ * @ingroup bmeloop
+ */
+void bme_loop_free(bme_loop_t *loop);
+
+/**
+ * Get the epoll descriptor, for nesting the loop in another one
+ *
+ * @ingroup bmeloop
+ */
+int32_t bme_loop_fd(const bme_loop_t *loop);
+
+/**
+ * Start watching a descriptor
+ *
+ * @param loop event loop
+ * @param fd descriptor
+ * @param events epoll event mask
+ * @param cb callback
+ * @param data user data for callback
+ *
+ * @return 0 on success, -1 on error
+ *
+ * @ingroup bmeloop
+ */
+int32_t bme_loop_add(bme_loop_t *loop, int32_t fd, uint32_t events,
+                     bme_loop_cb cb, void *data);
+
+/**
+ * Change the events a descriptor is watched for
+ *
+ * @return 0 on success, -1 on error
+ *
+ * @ingroup bmeloop
+ */
+int32_t bme_loop_mod(bme_loop_t *loop, int32_t fd, uint32_t events);
+
+/**
+ * Stop watching a descriptor; safe to call from any callback
+ *
+ * @return 0 on success, -1 on error
+ *
+ * @ingroup bmeloop
+ */
+int32_t bme_loop_del(bme_loop_t *loop, int32_t fd);
+
+/**
+ * Wait for events once and dispatch them
+ *
+ * @param loop event loop
+ * @param timeout_ms maximum time to wait, -1 for no limit
+ *
+ * @return number of events dispatched, -1 on error
+ *
+ * @ingroup bmeloop
+ */
+int32_t bme_loop_iterate(bme_loop_t *loop, int32_t timeout_ms);
+
+/**
+ * Dispatch events until bme_loop_quit() is called
+ *
+ * @return 0 after bme_loop_quit(), -1 on error
+ *
+ * @ingroup bmeloop
+ */
+int32_t bme_loop_run(bme_loop_t *loop);
+
+/**
+ * Make bme_loop_run() return after the current iteration
+ *
+ * @ingroup bmeloop
+ */
+void bme_loop_quit(bme_loop_t *loop);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMELOOP_H */
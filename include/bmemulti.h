@@ -0,0 +1,134 @@
+/**
+   @file bmemulti.h
+
+   @brief Concurrent queries to several BME servers
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BMEMULTI_H
+#define BMEMULTI_H
+
+#include <stdint.h>
+
+#include "bmeipc.h"
+#include "bmemsg.h"
+#include "bmeloop.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct bme_multi_s bme_multi_t;
+
+/* What to ask each endpoint */
+#define BME_MULTI_STAT         0x1      /* BME_SYSMSG_PROXY_GETTIME */
+#define BME_MULTI_BATTERY_INFO 0x2      /* BME_BATTERY_INFO_REQ */
+
+/**
+ * A server to query
+ */
+typedef struct
+{
+  const char *path;             /* socket path, NULL for BME_SRV_SOCK_PATH */
+  int32_t timeout_ms;           /* deadline, from the start of the query;
+                                 * 0 or less waits for the server without
+                                 * one, until it answers or hangs up */
+} bme_endpoint_t;
+
+/**
+ * One answer, or the failure to get it
+ */
+typedef struct
+{
+  int32_t endpoint;             /* index into the endpoint array */
+  uint32_t what;                /* a single BME_MULTI_* bit */
+  int32_t status;               /* server status, -1 on failure */
+  int32_t error;                /* errno value for failures, ETIMEDOUT
+                                 * past the deadline, 0 if the server
+                                 * refused */
+  const bmestat_t *stat;        /* BME_MULTI_STAT reply, else NULL */
+  const struct emsg_battery_info_reply *info;   /* BME_MULTI_BATTERY_INFO
+                                                 * reply, else NULL */
+} bme_multi_result_t;
+
+/**
+ * Result callback; pointers in @res are valid during the call only
+ */
+typedef void (*bme_multi_cb) (bme_multi_t *query,
+                              const bme_multi_result_t *res, void *user);
+
+/**
+ * Start querying several servers at once
+ *
+ * Every endpoint gets its own connection and is asked for everything
+ * in @what. Results are reported from @loop as they arrive, one call
+ * of @cb per endpoint and BME_MULTI_* bit, whether it succeeded,
+ * failed or ran out of time.
+ *
+ * @param loop event loop
+ * @param ep endpoints; only read during the call
+ * @param count number of endpoints
+ * @param what BME_MULTI_* bits
+ * @param info_flags BME_BATTERY_* flags for BME_MULTI_BATTERY_INFO
+ * @param cb result callback
+ * @param user user data for callback
+ *
+ * @return query, NULL on error
+ *
+ * @ingroup bmeasync
+ */
+bme_multi_t *bme_multi_start(bme_loop_t *loop, const bme_endpoint_t *ep,
+                             int32_t count, uint32_t what,
+                             uint32_t info_flags, bme_multi_cb cb,
+                             void *user);
+
+/**
+ * Number of results not reported yet
+ *
+ * @ingroup bmeasync
+ */
+int32_t bme_multi_pending(const bme_multi_t *query);
+
+/**
+ * Cancel outstanding requests and free a query
+ *
+ * No callbacks are made for the cancelled requests. Safe to call from
+ * the result callback.
+ *
+ * @ingroup bmeasync
+ */
+void bme_multi_free(bme_multi_t *query);
+
+/**
+ * Query several servers at once and wait for all results
+ *
+ * Runs bme_multi_start() on a private event loop until every result
+ * has been reported to @cb, which must not free the query.
+ *
+ * @return 0 on success, -1 if the query could not be started
+ *
+ * @ingroup bmeasync
+ */
+int32_t bme_multi_run(const bme_endpoint_t *ep, int32_t count, uint32_t what,
+                      uint32_t info_flags, bme_multi_cb cb, void *user);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMEMULTI_H */
@@ -0,0 +1,123 @@
+/**
+   @file bmepoller.h
+
+   @brief Shared periodic polling of BME statistics
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BMEPOLLER_H
+#define BMEPOLLER_H
+
+#include <stdint.h>
+
+#include "bmeipc.h"
+#include "bmeloop.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Subscribers ask for statistics every period_ms, and accept being
+ * served up to slack_ms late. A tick is scheduled for the earliest
+ * moment some subscriber's slack runs out, moved back onto a coarse
+ * grid when that subscriber allows it so that pollers in different
+ * processes tend to wake together. Every subscriber that is due by
+ * then is served from a single BME_SYSMSG_PROXY_GETTIME.
+ */
+
+typedef struct bme_poller_s bme_poller_t;
+typedef struct bme_poll_sub_s bme_poll_sub_t;
+
+/* Tick times are aligned to multiples of this where slack permits */
+#define BME_POLLER_GRID_MS 250
+
+/* A request unanswered this long fails its subscribers with ETIMEDOUT
+ * and the server is reconnected, as blocking requests time out */
+#define BME_POLLER_TIMEOUT_MS 5000
+
+/**
+ * Subscriber callback
+ *
+ * @param sub subscription
+ * @param stat statistics, NULL with errno set if the request failed
+ * @param changed slots changed since this subscriber's previous call,
+ *                all bits on the first call
+ * @param user user data given to bme_poller_add()
+ */
+typedef void (*bme_poll_cb) (bme_poll_sub_t *sub, const bmestat_t *stat,
+                             uint32_t changed, void *user);
+
+/**
+ * Create a poller attached to an event loop
+ *
+ * The server is connected on the first tick and reconnected after
+ * failures, including a request left unanswered for
+ * BME_POLLER_TIMEOUT_MS.
+ *
+ * @param loop event loop
+ * @param path socket path, NULL for BME_SRV_SOCK_PATH
+ *
+ * @return poller, NULL on error
+ *
+ * @ingroup bmeasync
+ */
+bme_poller_t *bme_poller_new(bme_loop_t *loop, const char *path);
+
+/**
+ * Free a poller and all its subscriptions; safe to call from a callback
+ *
+ * @ingroup bmeasync
+ */
+void bme_poller_free(bme_poller_t *poller);
+
+/**
+ * Subscribe to periodic statistics
+ *
+ * @param poller poller
+ * @param period_ms interval between calls
+ * @param slack_ms how late a call may be, at most @period_ms
+ * @param cb callback
+ * @param user user data for callback
+ *
+ * @return subscription, NULL on error
+ *
+ * @ingroup bmeasync
+ */
+bme_poll_sub_t *bme_poller_add(bme_poller_t *poller, int32_t period_ms,
+                               int32_t slack_ms, bme_poll_cb cb, void *user);
+
+/**
+ * Cancel a subscription; safe to call from any callback
+ *
+ * @ingroup bmeasync
+ */
+void bme_poller_remove(bme_poll_sub_t *sub);
+
+/**
+ * Number of statistics requests sent so far
+ *
+ * @ingroup bmeasync
+ */
+uint32_t bme_poller_requests(const bme_poller_t *poller);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMEPOLLER_H */
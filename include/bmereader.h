@@ -0,0 +1,132 @@
+/**
+   @file bmereader.h
+
+   @brief Background reader thread for a BME IPC connection
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BMEREADER_H
+#define BMEREADER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A reader thread owns the receive side of a connection. Replies are
+ * handed straight to the thread waiting in bme_reader_send_get_reply();
+ * unsolicited packets such as BME_INFO_IND go to a bounded lock-free
+ * queue that any number of consumer threads drain. The reader never
+ * blocks on consumers: when the queue is full new packets are dropped
+ * and counted, so a burst of indications cannot stall replies.
+ */
+
+typedef struct bme_reader_s bme_reader_t;
+
+/* Largest unsolicited packet queued; larger ones are dropped. Sized
+ * so that a queue slot fills two cache lines. */
+#define BME_READER_MSG_MAX 116
+
+/**
+ * Start a reader thread on a connected socket
+ *
+ * From now on the socket must only be used through the reader.
+ *
+ * @param fd socket descriptor from bmeipc_open() or similar; not
+ *           closed by the reader
+ * @param capacity queue slots for unsolicited packets, rounded up to a
+ *                 power of two
+ *
+ * @return reader, NULL on error
+ *
+ * @ingroup bmeipc
+ */
+bme_reader_t *bme_reader_new(int32_t fd, int32_t capacity);
+
+/**
+ * Stop the reader thread and free it
+ *
+ * No request may be in progress.
+ *
+ * @ingroup bmeipc
+ */
+void bme_reader_free(bme_reader_t *reader);
+
+/**
+ * Send a request and wait for its reply, as bme_send_get_reply()
+ *
+ * May be called from several threads at once; requests are pipelined.
+ *
+ * @return server status, -1 on error
+ *
+ * @ingroup bmeipc
+ */
+int32_t bme_reader_send_get_reply(bme_reader_t *reader, const void *smsg,
+                                  int32_t sbytes, void *rmsg, int32_t rbytes,
+                                  int32_t *rbytes_act);
+
+/**
+ * Descriptor that polls readable while unsolicited packets are queued
+ *
+ * Wakeups are batched: one per burst read off the socket, not one per
+ * packet.
+ *
+ * @ingroup bmeipc
+ */
+int32_t bme_reader_fd(const bme_reader_t *reader);
+
+/**
+ * Take an unsolicited packet off the queue without blocking
+ *
+ * @param reader reader
+ * @param msg buffer of at least BME_READER_MSG_MAX bytes
+ * @param bytes buffer size
+ *
+ * @return packet size; -1 with errno EAGAIN if the queue is empty,
+ *         ECONNRESET if it is empty and the connection is gone
+ *
+ * @ingroup bmeipc
+ */
+int32_t bme_reader_pop(bme_reader_t *reader, void *msg, int32_t bytes);
+
+/**
+ * Take an unsolicited packet off the queue, waiting for one
+ *
+ * @param timeout_ms maximum time to wait, -1 for no limit
+ *
+ * @return as bme_reader_pop(), errno ETIMEDOUT on timeout
+ *
+ * @ingroup bmeipc
+ */
+int32_t bme_reader_wait(bme_reader_t *reader, void *msg, int32_t bytes,
+                        int32_t timeout_ms);
+
+/**
+ * Number of unsolicited packets dropped so far
+ *
+ * @ingroup bmeipc
+ */
+uint32_t bme_reader_dropped(const bme_reader_t *reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMEREADER_H */
@@ -0,0 +1,246 @@
+/**
+   @file bmesrv.h
+
+   @brief Fair request dispatcher for BME compatible servers
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BMESRV_H
+#define BMESRV_H
+
+#include <stdint.h>
+
+#include "bmeipc.h"
+#include "bmeloop.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The dispatcher accepts clients on a socket, does the cookie
+ * handshake and queues each client's requests separately. Queues are
+ * served by deficit round robin: every turn a client may have as many
+ * requests handled as its weight, so a client that sends a burst only
+ * delays the others by one turn. A client whose queue is full is not
+ * read from until it drains. Nothing blocks: the cookie is parsed from
+ * what the client has sent so far, and replies the socket cannot take
+ * yet are kept until it can; meanwhile that client is neither read
+ * from nor served.
+ *
+ * A handler that has to wait for something, such as an upstream
+ * server, takes the request over with bme_srv_defer() and answers it
+ * later. Replies to a v1 client must keep request order, so the rest
+ * of its queue waits until then; v2 clients go on being served.
+ *
+ * Requests can be limited per client by a token bucket. A request
+ * over quota is answered at once with status BME_SRV_REJECTED and
+ * never reaches the handler. v1 clients expect replies in request
+ * order, so a rejection for one with requests queued waits its turn,
+ * without being charged to the client's weight.
+ */
+
+typedef struct bme_srv_s bme_srv_t;
+typedef struct bme_srv_client_s bme_srv_client_t;
+typedef struct bme_srv_request_s bme_srv_request_t;
+
+/* Status of requests rejected for being over quota */
+#define BME_SRV_REJECTED (-2)
+
+/* Requests queued per client unless set otherwise */
+#define BME_SRV_QUEUE 32
+
+/* Largest request accepted */
+#define BME_SRV_MAX_PACKET 4096
+
+/**
+ * Request handler
+ *
+ * Must answer the request with bme_srv_reply() or take it over with
+ * bme_srv_defer() before returning; otherwise the client gets status
+ * -1. @req is aligned for any message struct and valid during the
+ * call only.
+ *
+ * @param client client that sent the request
+ * @param frame header fields of the request
+ * @param req request data
+ * @param bytes size of request data
+ * @param user user data given to bme_srv_new()
+ */
+typedef void (*bme_srv_handler) (bme_srv_client_t *client,
+                                 const bmeipc_frame_t *frame,
+                                 const void *req, int32_t bytes,
+                                 void *user);
+
+/**
+ * Client callback, called after the handshake with @connected set and
+ * when the client goes away with @connected clear
+ */
+typedef void (*bme_srv_client_cb) (bme_srv_client_t *client,
+                                   int32_t connected, void *user);
+
+/**
+ * Listen on a socket and dispatch requests from an event loop
+ *
+ * @param loop event loop
+ * @param path socket path; an existing socket file is replaced
+ * @param cookie handshake cookie, NULL for BME_SRV_COOKIE
+ * @param handler request handler
+ * @param user user data for callbacks
+ *
+ * @return dispatcher, NULL on error
+ *
+ * @ingroup bmeipc
+ */
+bme_srv_t *bme_srv_new(bme_loop_t *loop, const char *path,
+                       const char *cookie, bme_srv_handler handler,
+                       void *user);
+
+/**
+ * Close all clients and the listening socket; not from a callback
+ *
+ * @ingroup bmeipc
+ */
+void bme_srv_free(bme_srv_t *srv);
+
+/**
+ * Push a packet, such as an indication from an upstream server, to
+ * every client that has sent v2 frames
+ *
+ * The packet goes out as a BMEIPC_F_PUSH frame. v1 clients do not get
+ * it: they cannot tell it from a reply, and one arriving ahead of a
+ * status would throw their replies out of step. A client whose output
+ * cannot be queued is closed.
+ *
+ * @param srv dispatcher
+ * @param data packet data
+ * @param bytes size of packet data
+ *
+ * @return number of clients the packet was queued for
+ *
+ * @ingroup bmeipc
+ */
+int32_t bme_srv_broadcast(bme_srv_t *srv, const void *data, int32_t bytes);
+
+/**
+ * Set the client callback
+ *
+ * @ingroup bmeipc
+ */
+void bme_srv_set_client_handler(bme_srv_t *srv, bme_srv_client_cb cb);
+
+/**
+ * Set the quota and queue length of clients connecting from now on
+ *
+ * @param srv dispatcher
+ * @param rate requests per second, 0 for no limit
+ * @param burst requests allowed at once
+ * @param queue requests queued per client, 0 for BME_SRV_QUEUE
+ *
+ * @ingroup bmeipc
+ */
+void bme_srv_set_limits(bme_srv_t *srv, int32_t rate, int32_t burst,
+                        int32_t queue);
+
+/**
+ * Answer the request being handled
+ *
+ * @param client client passed to the handler
+ * @param status status word, negative for failure
+ * @param data reply data, or NULL for a status-only reply
+ * @param bytes size of reply data
+ *
+ * @return 0 on success, -1 on error; the client is then closed
+ *
+ * @ingroup bmeipc
+ */
+int32_t bme_srv_reply(bme_srv_client_t *client, int32_t status,
+                      const void *data, int32_t bytes);
+
+/**
+ * Take over the request being handled, to answer it after the handler
+ * has returned
+ *
+ * Every deferred request must be answered with bme_srv_request_reply(),
+ * which also releases it, even if the client has gone away meanwhile.
+ *
+ * @param client client passed to the handler
+ *
+ * @return request, NULL on error
+ *
+ * @ingroup bmeipc
+ */
+bme_srv_request_t *bme_srv_defer(bme_srv_client_t *client);
+
+/**
+ * Answer a deferred request and release it
+ *
+ * @param request request from bme_srv_defer()
+ * @param status status word, negative for failure
+ * @param data reply data, or NULL for a status-only reply
+ * @param bytes size of reply data
+ *
+ * @return 0 on success, -1 on error: errno ECONNRESET if the client
+ *         has gone away, else the client is then closed
+ *
+ * @ingroup bmeipc
+ */
+int32_t bme_srv_request_reply(bme_srv_request_t *request, int32_t status,
+                              const void *data, int32_t bytes);
+
+/**
+ * Close a client; safe to call from any callback
+ *
+ * @ingroup bmeipc
+ */
+void bme_srv_client_close(bme_srv_client_t *client);
+
+/**
+ * Get the socket descriptor of a client
+ *
+ * @ingroup bmeipc
+ */
+int32_t bme_srv_client_fd(const bme_srv_client_t *client);
+
+/**
+ * Set the share of a client: requests handled per round robin turn
+ *
+ * @ingroup bmeipc
+ */
+void bme_srv_client_set_weight(bme_srv_client_t *client, int32_t weight);
+
+/**
+ * Set the quota of a client, as bme_srv_set_limits()
+ *
+ * @ingroup bmeipc
+ */
+void bme_srv_client_set_quota(bme_srv_client_t *client, int32_t rate,
+                              int32_t burst);
+
+/**
+ * Number of requests of a client rejected so far
+ *
+ * @ingroup bmeipc
+ */
+uint32_t bme_srv_client_rejected(const bme_srv_client_t *client);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMESRV_H */
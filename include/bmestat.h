@@ -0,0 +1,183 @@
+/**
+   @file bmestat.h
+
+   @brief BME statistics snapshot helpers
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BMESTAT_H
+#define BMESTAT_H
+
+#include <stdint.h>
+
+#include "bmeipc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Packed values of changed bmestat_t slots, see bmestat_diff() */
+typedef int32_t bmestat_delta_t[BME_LAST_STAT_IDX];
+
+/**
+ * Compare two statistics snapshots
+ *
+ * Bit n of the returned mask is set when slot n of @cur differs from
+ * slot n of @prev. If @delta is not NULL, the values of the changed
+ * slots of @cur are packed into it in ascending slot order, so that
+ * the first bmestat_delta_count(mask) entries are valid.
+ *
+ * @param prev previous snapshot
+ * @param cur current snapshot
+ * @param delta buffer for the packed values of changed slots, or NULL
+ *
+ * @return mask of changed slots, 0 if the snapshots are equal
+ *
+ * @ingroup bmeipc
+ */
+uint32_t bmestat_diff(const bmestat_t *prev, const bmestat_t *cur,
+                      int32_t *delta);
+
+/**
+ * Apply packed values produced by bmestat_diff() to a snapshot
+ *
+ * @param stat snapshot to update
+ * @param mask mask of changed slots
+ * @param delta packed values of the changed slots
+ *
+ * @return number of values consumed from @delta
+ *
+ * @ingroup bmeipc
+ */
+int32_t bmestat_patch(bmestat_t *stat, uint32_t mask, const int32_t *delta);
+
+/**
+ * Number of packed values that go with a changed-slot mask
+ */
+static inline int32_t
+bmestat_delta_count(uint32_t mask)
+{
+  return __builtin_popcount(mask);
+}
+
+/*
+ * BME_SYSMSG_PROXY_GETTIME_DELTA
+ *
+ * The client names the generation of the snapshot it holds and gets
+ * back only the slots that changed since, as a changed-slot mask and
+ * packed values. Generation 0 asks for everything; so does any
+ * generation the server does not know, e.g. one from before a restart.
+ * An unchanged snapshot costs an 8-byte reply.
+ */
+
+/** No snapshot held */
+#define BMESTAT_GEN_NONE   0u
+/** Server lacks delta support, bmeipc_stat_delta() uses full replies */
+#define BMESTAT_GEN_LEGACY 0xffffffffu
+
+typedef struct
+{
+  uint16_t type;                /* BME_SYSMSG_PROXY_GETTIME_DELTA */
+  uint16_t subtype;             /* 0 */
+  uint32_t gen;                 /* generation held by the client */
+} bmestat_delta_req_t;
+
+/* Reply data; followed by bmestat_delta_count(mask) int32_t values */
+typedef struct
+{
+  uint32_t gen;                 /* generation of the resulting snapshot */
+  uint32_t mask;                /* changed slots */
+} bmestat_delta_reply_t;
+
+/** Largest reply data */
+#define BMESTAT_DELTA_MAX (sizeof(bmestat_delta_reply_t) + sizeof(bmestat_t))
+
+/**
+ * Server side change log of a statistics snapshot
+ *
+ * Tracks the generation in which each slot last changed, which is
+ * enough to answer any generation since the log was started.
+ */
+typedef struct
+{
+  uint32_t base;                /* first generation */
+  uint32_t gen;                 /* current generation */
+  bmestat_t stat;               /* current snapshot */
+  uint32_t changed[BME_LAST_STAT_IDX]; /* generation of last change */
+} bmestat_log_t;
+
+/**
+ * Start a change log
+ *
+ * @param log log to initialise
+ * @param base first generation; should differ between server
+ *             instances, BMESTAT_GEN_NONE picks one from the clock
+ *
+ * @ingroup bmeipc
+ */
+void bmestat_log_init(bmestat_log_t *log, uint32_t base);
+
+/**
+ * Record a new snapshot, starting a new generation if anything changed
+ *
+ * @param log change log
+ * @param cur current snapshot
+ *
+ * @return current generation
+ *
+ * @ingroup bmeipc
+ */
+uint32_t bmestat_log_update(bmestat_log_t *log, const bmestat_t *cur);
+
+/**
+ * Encode the reply data for a client holding generation @since
+ *
+ * @param log change log
+ * @param since generation held by the client
+ * @param buf int32_t aligned buffer of at least BMESTAT_DELTA_MAX bytes
+ *
+ * @return number of bytes stored in @buf
+ *
+ * @ingroup bmeipc
+ */
+int32_t bmestat_log_encode(const bmestat_log_t *log, uint32_t since,
+                           void *buf);
+
+/**
+ * Bring a statistics snapshot up to date from BME server
+ *
+ * Start with *@gen set to BMESTAT_GEN_NONE and pass the same @stat and
+ * @gen on every call. A server that answers the delta request with a
+ * failure status lacks delta support and is polled with full requests
+ * from then on; a timeout or I/O error only fails the call.
+ *
+ * @param sd socket descriptor
+ * @param stat snapshot to update
+ * @param gen generation of @stat, updated
+ *
+ * @return 1 if @stat changed, 0 if not, -1 on error
+ *
+ * @ingroup bmeipc
+ */
+int32_t bmeipc_stat_delta(int32_t sd, bmestat_t *stat, uint32_t *gen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMESTAT_H */
@@ -0,0 +1,106 @@
+/**
+   @file bmestate.h
+
+   @brief Statistics, battery info and charger state in one request
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BMESTATE_H
+#define BMESTATE_H
+
+#include <stdint.h>
+
+#include "bmeipc.h"
+#include "bmemsg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * BME_SYSMSG_FULL_STATE answers what used to take a
+ * BME_SYSMSG_PROXY_GETTIME, a BME_BATTERY_INFO_REQ and waiting for a
+ * BME_INFO_IND. The reply is a bmeipc_full_state_t; servers may append
+ * fields in later versions, so clients accept longer replies up to
+ * BME_FULL_STATE_MAX bytes and ignore the rest.
+ */
+
+/* Parts of bmeipc_full_state_t that were filled in */
+#define BME_FULL_STATE_STAT 0x1 /* stat */
+#define BME_FULL_STATE_INFO 0x2 /* info */
+#define BME_FULL_STATE_IND  0x4 /* ind, absent until the server has seen
+                                 * an info indication */
+#define BME_FULL_STATE_LEGACY 0x80000000 /* server lacks
+                                          * BME_SYSMSG_FULL_STATE */
+
+/* Longest reply accepted */
+#define BME_FULL_STATE_MAX 512
+
+/* Status of a server that knows the request but has none of the parts
+ * at hand, such as a proxy whose server is down; ask again later */
+#define BME_FULL_STATE_RETRY (-3)
+
+/**
+ * Full state request
+ */
+typedef struct
+{
+  uint16_t type;                /* BME_SYSMSG_FULL_STATE */
+  uint16_t subtype;
+  uint32_t flags;               /* BME_BATTERY_* flags for info */
+} bmeipc_full_state_req_t;
+
+/**
+ * Full state reply
+ */
+typedef struct
+{
+  uint32_t valid;               /* BME_FULL_STATE_* bits */
+  uint32_t reserved;
+  bmestat_t stat;               /* as for BME_SYSMSG_PROXY_GETTIME */
+  struct emsg_battery_info_reply info;  /* as for BME_BATTERY_INFO_REQ */
+  struct emsg_info_ind ind;     /* last BME_INFO_IND */
+} bmeipc_full_state_t;
+
+/**
+ * Retrieve statistics, battery info and the last info indication
+ *
+ * Start with @state zeroed and pass the same @state on every call.
+ * A server that answers BME_SYSMSG_FULL_STATE with a failure status
+ * does not know it; BME_FULL_STATE_LEGACY is then set in
+ * @state->valid and from then on the statistics and the battery info
+ * are asked for separately, without the info indication. A timeout or
+ * I/O error only fails the call, and so do BME_FULL_STATE_RETRY and a
+ * quota rejection (BME_SRV_REJECTED), with errno EAGAIN.
+ *
+ * @param sd socket descriptor
+ * @param flags BME_BATTERY_* flags for the battery info
+ * @param state the structure to populate, kept between calls
+ *
+ * @return 0 on success, -1 on error
+ *
+ * @ingroup bmeipc
+ */
+int32_t bmeipc_full_state(int32_t sd, uint32_t flags,
+                          bmeipc_full_state_t *state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMESTATE_H */
@@ -0,0 +1,144 @@
+/**
+   @file bmearena.c
+
+   @brief Bump allocator for BME replies
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <errno.h>
+
+#include "bmearena.h"
+
+#define ARENA_MIN 256
+
+/*
+ * Allocations are carved from the newest block. When it is full a
+ * block twice the size is started; the older ones must stay until the
+ * reset because earlier allocations still point into them, and are
+ * freed then, so after a reset only the largest block is left.
+ */
+typedef struct arena_block_s
+{
+  struct arena_block_s *older;
+  size_t size;
+  size_t used;
+  max_align_t data[];
+} arena_block_t;
+
+struct bme_arena_s
+{
+  arena_block_t *block;
+};
+
+static arena_block_t *
+block_new(size_t size, arena_block_t *older)
+{
+  arena_block_t *b;
+
+  if ((b = malloc(sizeof *b + size)) == 0)
+  {
+    return 0;
+  }
+  b->older = older;
+  b->size = size;
+  b->used = 0;
+  return b;
+}
+
+bme_arena_t *
+bme_arena_new(int32_t size)
+{
+  bme_arena_t *arena;
+
+  if (size < ARENA_MIN)
+  {
+    size = ARENA_MIN;
+  }
+  if ((arena = malloc(sizeof *arena)) == 0)
+  {
+    return 0;
+  }
+  if ((arena->block = block_new(size, 0)) == 0)
+  {
+    free(arena);
+    return 0;
+  }
+  return arena;
+}
+
+void
+bme_arena_free(bme_arena_t *arena)
+{
+  if (arena == 0)
+  {
+    return;
+  }
+  bme_arena_reset(arena);
+  free(arena->block);
+  free(arena);
+}
+
+void *
+bme_arena_alloc(bme_arena_t *arena, int32_t bytes)
+{
+  const size_t align = _Alignof(max_align_t);
+  arena_block_t *b = arena->block;
+  size_t off;
+
+  if (bytes < 0)
+  {
+    errno = EINVAL;
+    return 0;
+  }
+
+  off = (b->used + align - 1) & ~(align - 1);
+  if (off + bytes > b->size)
+  {
+    size_t size = b->size * 2;
+
+    while (size < (size_t) bytes)
+    {
+      size *= 2;
+    }
+    if ((b = block_new(size, b)) == 0)
+    {
+      return 0;
+    }
+    arena->block = b;
+    off = 0;
+  }
+  b->used = off + bytes;
+  return (char *)b->data + off;
+}
+
+void
+bme_arena_reset(bme_arena_t *arena)
+{
+  arena_block_t *b = arena->block->older;
+
+  while (b)
+  {
+    arena_block_t *older = b->older;
+    free(b);
+    b = older;
+  }
+  arena->block->older = 0;
+  arena->block->used = 0;
+}
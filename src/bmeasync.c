@@ -0,0 +1,779 @@
+/**
+   @file bmeasync.c
+
+   @brief Non-blocking BME IPC connections
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "bmeipc.h"
+#include "bmeipc-internal.h"
+#include "bmecapture.h"
+#include "bmeframe.h"
+#include "bmeloop.h"
+#include "bmeasync.h"
+
+/* Largest packet accepted from the peer */
+#define ACONN_MAX_PACKET (1024 * 1024)
+
+/* Initial receive buffer size */
+#define ACONN_RX_SIZE 4096
+
+typedef struct pending_s
+{
+  struct pending_s *next;
+  uint32_t reqid;
+  bme_reply_cb cb;
+  void *user;
+  int with_data;
+  int have_status;
+  int32_t status;
+} pending_t;
+
+struct bme_aconn_s
+{
+  bme_loop_t *loop;
+  int fd;
+  int failed;
+  int busy;                     // inside event handling
+  int closing;                  // close requested while busy
+  int handshake;                // waiting for the cookie ack
+  int v2;                       // server speaks v2 framing
+  uint32_t next_reqid;
+
+  char *tx;                     // unsent bytes of framed packets
+  size_t txoff, txlen, txcap;
+
+  bmeipc_rx_t rx;               // received, not yet handled bytes
+
+  pending_t *head, *tail;       // requests waiting for reply
+  pending_t *spare;             // recycled request slots
+
+  int timeout_ms;               // reply timeout, 0 = none
+  int tfd;                      // reply timer, -1 until first needed
+  int armed;                    // tfd is set to go off
+  struct timespec progress;     // when the server last answered
+
+  bme_packet_cb pcb;
+  void *puser;
+};
+
+static void aconn_event(bme_loop_t *loop, int32_t fd, uint32_t events,
+                        void *data);
+static void aconn_timer(bme_loop_t *loop, int32_t fd, uint32_t events,
+                        void *data);
+
+static void
+aconn_destroy(bme_aconn_t *c)
+{
+  pending_t *p;
+
+  if (c->fd != -1)
+  {
+    bme_loop_del(c->loop, c->fd);
+    close(c->fd);
+  }
+  if (c->tfd != -1)
+  {
+    bme_loop_del(c->loop, c->tfd);
+    close(c->tfd);
+  }
+  while ((p = c->head) != 0)
+  {
+    c->head = p->next;
+    free(p);
+  }
+  while ((p = c->spare) != 0)
+  {
+    c->spare = p->next;
+    free(p);
+  }
+  free(c->tx);
+  _bme_rx_free(&c->rx);
+  free(c);
+}
+
+/**
+ * Fail all pending requests and stop using the socket
+ */
+static void
+aconn_fail(bme_aconn_t *c, int err)
+{
+  pending_t *p;
+
+  if (c->failed)
+  {
+    return;
+  }
+  c->failed = 1;
+  c->tail = 0;
+  bme_loop_del(c->loop, c->fd);
+  if (c->tfd != -1)
+  {
+    bme_loop_del(c->loop, c->tfd);
+  }
+
+  while ((p = c->head) != 0 && !c->closing)
+  {
+    c->head = p->next;
+    errno = err;
+    p->cb(c, -1, 0, 0, p->user);
+    free(p);
+  }
+  if (c->pcb && !c->closing)
+  {
+    errno = err;
+    c->pcb(c, 0, -1, c->puser);
+  }
+}
+
+static int
+aconn_update_events(bme_aconn_t *c)
+{
+  uint32_t ev = EPOLLIN | (c->txoff < c->txlen ? EPOLLOUT : 0);
+  return bme_loop_mod(c->loop, c->fd, ev);
+}
+
+static int
+aconn_flush(bme_aconn_t *c)
+{
+  while (c->txoff < c->txlen)
+  {
+    ssize_t n = send(c->fd, c->tx + c->txoff, c->txlen - c->txoff,
+                     MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      return -1;
+    }
+    c->txoff += n;
+  }
+  if (c->txoff == c->txlen)
+  {
+    c->txoff = c->txlen = 0;
+  }
+  return aconn_update_events(c);
+}
+
+/**
+ * Is an answer from the server awaited
+ */
+static int
+aconn_awaiting(const bme_aconn_t *c)
+{
+  return c->head != 0 || c->handshake;
+}
+
+/**
+ * Set the reply timer to go off @ms from now
+ */
+static int
+aconn_arm(bme_aconn_t *c, int ms)
+{
+  struct itimerspec its;
+
+  if (c->tfd == -1)
+  {
+    c->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (c->tfd == -1)
+    {
+      return -1;
+    }
+    if (bme_loop_add(c->loop, c->tfd, EPOLLIN, aconn_timer, c) == -1)
+    {
+      close(c->tfd);
+      c->tfd = -1;
+      return -1;
+    }
+  }
+  memset(&its, 0, sizeof its);
+  its.it_value.tv_sec = ms / 1000;
+  its.it_value.tv_nsec = (ms % 1000) * 1000000L;
+  if (timerfd_settime(c->tfd, 0, &its, 0) == -1)
+  {
+    return -1;
+  }
+  c->armed = 1;
+  return 0;
+}
+
+/**
+ * Start timing the server when it gets something to answer
+ *
+ * Called before the request is queued. The timer is not moved on every
+ * reply; when it goes off it is pushed back by the time since the
+ * last one instead.
+ */
+static int
+aconn_watch(bme_aconn_t *c)
+{
+  if (c->timeout_ms <= 0)
+  {
+    return 0;
+  }
+  if (!aconn_awaiting(c))
+  {
+    clock_gettime(CLOCK_MONOTONIC, &c->progress);
+  }
+  return c->armed ? 0 : aconn_arm(c, c->timeout_ms);
+}
+
+/**
+ * Milliseconds since the server last answered
+ */
+static long
+aconn_idle(const bme_aconn_t *c)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - c->progress.tv_sec) * 1000 +
+    (now.tv_nsec - c->progress.tv_nsec) / 1000000;
+}
+
+static void
+aconn_timer(bme_loop_t *loop, int32_t fd, uint32_t events, void *data)
+{
+  bme_aconn_t *c = data;
+  uint64_t ticks;
+  long idle;
+
+  (void)loop;
+  (void)events;
+
+  if (read(fd, &ticks, sizeof ticks) == -1 && errno == EAGAIN)
+  {
+    return;
+  }
+  c->armed = 0;
+  if (c->failed || c->timeout_ms <= 0 || !aconn_awaiting(c))
+  {
+    return;
+  }
+
+  idle = aconn_idle(c);
+  if (idle < c->timeout_ms && aconn_arm(c, c->timeout_ms - idle) == 0)
+  {
+    return;
+  }
+
+  log_warn_F("[fd=%d]: no reply in %d ms\n", c->fd, c->timeout_ms);
+  c->busy++;
+  aconn_fail(c, ETIMEDOUT);
+  if (--c->busy == 0 && c->closing)
+  {
+    aconn_destroy(c);
+  }
+}
+
+/**
+ * Complete a request and recycle its slot
+ */
+static void
+aconn_complete(bme_aconn_t *c, pending_t *p, const char *data, int32_t size)
+{
+  if (c->armed)
+  {
+    clock_gettime(CLOCK_MONOTONIC, &c->progress);
+  }
+  if (p->status < 0)
+  {
+    errno = 0;                  // refused by the server, not failed here
+  }
+  p->cb(c, p->status, data, size, p->user);
+  p->next = c->spare;
+  c->spare = p;
+}
+
+/**
+ * Handle a v2 reply, which may answer any pending request
+ */
+static void
+aconn_deliver_v2(bme_aconn_t *c, const bmeipc_frame_t *frame,
+                 const char *data, int32_t size)
+{
+  pending_t **pp, *prev = 0;
+
+  for (pp = &c->head; *pp; prev = *pp, pp = &(*pp)->next)
+  {
+    pending_t *p = *pp;
+
+    if (p->reqid != frame->reqid)
+    {
+      continue;
+    }
+    if (size < (int32_t) sizeof p->status)
+    {
+      aconn_fail(c, EBADMSG);
+      return;
+    }
+    *pp = p->next;
+    if (c->tail == p)
+    {
+      c->tail = prev;
+    }
+    memcpy(&p->status, data, sizeof p->status);
+    size -= sizeof p->status;
+    aconn_complete(c, p, size ? data + sizeof p->status : 0, size);
+    return;
+  }
+
+  log_warn_F("[fd=%d]: reply to unknown request %u\n", c->fd, frame->reqid);
+}
+
+/**
+ * Handle one complete packet
+ */
+static void
+aconn_deliver(bme_aconn_t *c, const bmeipc_frame_t *frame,
+              const char *data, int32_t size)
+{
+  pending_t *p = c->head;
+
+  _bme_capture(c->fd, BMECAP_READ, data, size);
+
+  if (c->handshake)
+  {
+    int32_t version = bmeipc_ack_version(data, size);
+
+    if (version == -1)
+    {
+      log_warn_F("[fd=%d]: read ack: got %d of %d bytes\n", c->fd, size, 1);
+      aconn_fail(c, EPROTO);
+      return;
+    }
+    c->handshake = 0;
+    c->v2 = version >= 2;
+    clock_gettime(CLOCK_MONOTONIC, &c->progress);
+    return;
+  }
+
+  if (frame->version == 2 && (frame->flags & BMEIPC_F_REPLY))
+  {
+    aconn_deliver_v2(c, frame, data, size);
+    return;
+  }
+
+  if (p == 0 || frame->version == 2)
+  {
+    if (c->pcb)
+    {
+      c->pcb(c, data, size, c->puser);
+    }
+    return;
+  }
+
+  if (!p->have_status)
+  {
+    /* Indications are never status sized, as in bmereader.c */
+    if (size != sizeof p->status)
+    {
+      if (c->pcb)
+      {
+        c->pcb(c, data, size, c->puser);
+      }
+      return;
+    }
+    memcpy(&p->status, data, sizeof p->status);
+    p->have_status = 1;
+    if (p->status >= 0 && p->with_data)
+    {
+      return;                   // data packet follows
+    }
+    data = 0;
+    size = 0;
+  }
+
+  c->head = p->next;
+  if (c->head == 0)
+  {
+    c->tail = 0;
+  }
+  aconn_complete(c, p, data, size);
+}
+
+/**
+ * Split received bytes into packets
+ */
+static void
+aconn_parse(bme_aconn_t *c)
+{
+  while (!c->failed && !c->closing)
+  {
+    bmeipc_frame_t frame;
+    char *data;
+    int32_t size;
+    int32_t rc = _bme_rx_next(&c->rx, &frame, &data, &size);
+
+    if (rc == 0)
+    {
+      break;
+    }
+    if (rc == -1)
+    {
+      log_warn_F("[fd=%d]: read header: %s\n", c->fd, "out of sync");
+      aconn_fail(c, EBADMSG);
+      return;
+    }
+    aconn_deliver(c, &frame, data, size);
+  }
+
+  if (!c->closing)
+  {
+    _bme_rx_compact(&c->rx);
+  }
+}
+
+static void
+aconn_read(bme_aconn_t *c)
+{
+  while (!c->failed && !c->closing)
+  {
+    size_t room;
+    char *p = _bme_rx_space(&c->rx, 1, &room);
+    ssize_t n;
+
+    if (p == 0)
+    {
+      aconn_fail(c, ENOMEM);
+      return;
+    }
+
+    n = recv(c->fd, p, room, MSG_DONTWAIT);
+    if (n == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        aconn_fail(c, errno);
+      return;
+    }
+    if (n == 0)
+    {
+      aconn_fail(c, ECONNRESET);
+      return;
+    }
+    c->rx.len += n;
+    aconn_parse(c);
+  }
+}
+
+static void
+aconn_event(bme_loop_t *loop, int32_t fd, uint32_t events, void *data)
+{
+  bme_aconn_t *c = data;
+
+  (void)loop;
+  (void)fd;
+
+  c->busy++;
+  if ((events & EPOLLOUT) && aconn_flush(c) == -1)
+  {
+    aconn_fail(c, errno);
+  }
+  if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+  {
+    aconn_read(c);
+  }
+  if (--c->busy == 0 && c->closing)
+  {
+    aconn_destroy(c);
+  }
+}
+
+static int aconn_send(bme_aconn_t *conn, uint32_t reqid, const void *msg,
+                      int32_t bytes);
+
+/**
+ * Connect, with the handshake done here or left to the event loop
+ */
+static bme_aconn_t *
+aconn_new(bme_loop_t *loop, const char *path, const char *cookie, int wait)
+{
+  struct sockaddr_un addr;
+  int32_t version = 1;
+  bme_aconn_t *c;
+
+  if ((c = calloc(1, sizeof *c)) == 0)
+  {
+    return 0;
+  }
+  c->loop = loop;
+  c->tfd = -1;
+  c->timeout_ms = BME_ACONN_TIMEOUT;
+  if (_bme_rx_init(&c->rx, ACONN_RX_SIZE, ACONN_MAX_PACKET) == -1)
+  {
+    free(c);
+    return 0;
+  }
+  if (cookie == 0)
+  {
+    cookie = BME_SRV_COOKIE;
+  }
+
+  c->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | (wait ? 0 : SOCK_NONBLOCK), 0);
+  if (c->fd == -1)
+  {
+    log_error_F("socket: %s\n", strerror(errno));
+    goto fail;
+  }
+
+  memset(&addr, 0, sizeof addr);
+  strncat(addr.sun_path, path ? path : BME_SRV_SOCK_PATH,
+          sizeof addr.sun_path - 1);
+  addr.sun_family = AF_UNIX;
+
+  /* A local connect completes or fails at once, even non-blocking */
+  if (connect(c->fd, (struct sockaddr *)&addr, sizeof addr) == -1)
+  {
+    goto fail;
+  }
+
+  if (wait)
+  {
+    if (_bme_cookie_write_ver(c->fd, cookie, &version) == -1 ||
+        fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK) == -1 ||
+        bme_loop_add(loop, c->fd, EPOLLIN, aconn_event, c) == -1)
+    {
+      goto fail;
+    }
+    c->v2 = version >= 2;
+    return c;
+  }
+
+  if (bme_loop_add(loop, c->fd, EPOLLIN, aconn_event, c) == -1)
+  {
+    goto fail;
+  }
+  if (aconn_watch(c) == -1 || aconn_send(c, 0, cookie, strlen(cookie)) == -1)
+  {
+    aconn_destroy(c);
+    return 0;
+  }
+  c->handshake = 1;
+  return c;
+
+fail:
+  if (c->fd != -1)
+  {
+    close(c->fd);
+  }
+  _bme_rx_free(&c->rx);
+  free(c);
+  return 0;
+}
+
+bme_aconn_t *
+bme_aconn_open(bme_loop_t *loop, const char *path, const char *cookie)
+{
+  return aconn_new(loop, path, cookie, 1);
+}
+
+bme_aconn_t *
+bme_aconn_connect(bme_loop_t *loop, const char *path, const char *cookie)
+{
+  return aconn_new(loop, path, cookie, 0);
+}
+
+void
+bme_aconn_close(bme_aconn_t *conn)
+{
+  if (conn == 0)
+  {
+    return;
+  }
+  if (conn->busy)
+  {
+    conn->closing = 1;
+    return;
+  }
+  aconn_destroy(conn);
+}
+
+int32_t
+bme_aconn_fd(const bme_aconn_t *conn)
+{
+  return conn->fd;
+}
+
+void
+bme_aconn_set_timeout(bme_aconn_t *conn, int32_t ms)
+{
+  long left;
+
+  conn->timeout_ms = ms > 0 ? ms : 0;
+  if (conn->timeout_ms && !conn->failed && aconn_awaiting(conn))
+  {
+    left = conn->timeout_ms - aconn_idle(conn);
+    aconn_arm(conn, left > 0 ? left : 1);
+  }
+}
+
+void
+bme_aconn_set_packet_handler(bme_aconn_t *conn, bme_packet_cb cb, void *user)
+{
+  conn->pcb = cb;
+  conn->puser = user;
+}
+
+/**
+ * Queue a packet, v2 framed with @reqid if the server speaks v2
+ */
+static int
+aconn_send(bme_aconn_t *conn, uint32_t reqid, const void *msg, int32_t bytes)
+{
+  bmeipc_header_v2 hdr = {
+    .base = {.sync = BMEIPC_SYNCWORD,.size = bytes },
+  };
+  size_t hlen = sizeof hdr.base;
+  size_t tot, done = 0;
+
+  if (conn->failed || conn->closing || bytes < 0)
+  {
+    errno = conn->failed ? ECONNRESET : EINVAL;
+    return -1;
+  }
+  if (conn->v2)
+  {
+    hdr.base.sync = BMEIPC_SYNCWORD_V2;
+    hdr.reqid = reqid;
+    if (bytes >= (int32_t) sizeof hdr.type)
+    {
+      memcpy(&hdr.type, msg, sizeof hdr.type);
+    }
+    hlen = sizeof hdr;
+  }
+  tot = hlen + bytes;
+
+  /* Write directly if nothing is queued; keep only what did not fit */
+  if (conn->txlen == 0)
+  {
+    struct iovec iov[2] = {
+      {.iov_base = &hdr,.iov_len = hlen},
+      {.iov_base = (void *)msg,.iov_len = bytes},
+    };
+    struct msghdr mh = {.msg_iov = iov,.msg_iovlen = 2 };
+    ssize_t n = TEMP_FAILURE_RETRY(sendmsg(conn->fd, &mh,
+                                           MSG_DONTWAIT | MSG_NOSIGNAL));
+    if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+      return -1;
+    }
+    done = n == -1 ? 0 : (size_t)n;
+  }
+
+  if (done < tot)
+  {
+    size_t need = conn->txlen + tot - done;
+
+    if (need > conn->txcap)
+    {
+      char *p = realloc(conn->tx, need);
+      if (p == 0)
+      {
+        return -1;
+      }
+      conn->tx = p;
+      conn->txcap = need;
+    }
+    if (done < hlen)
+    {
+      memcpy(conn->tx + conn->txlen, (char *)&hdr + done, hlen - done);
+      conn->txlen += hlen - done;
+      done = hlen;
+    }
+    memcpy(conn->tx + conn->txlen, (const char *)msg + (done - hlen),
+           tot - done);
+    conn->txlen += tot - done;
+    if (aconn_update_events(conn) == -1)
+    {
+      return -1;
+    }
+  }
+
+  _bme_capture(conn->fd, BMECAP_WRITE, msg, bytes);
+  return 0;
+}
+
+int32_t
+bme_aconn_send(bme_aconn_t *conn, const void *msg, int32_t bytes)
+{
+  return aconn_send(conn, 0, msg, bytes);
+}
+
+int32_t
+bme_aconn_request(bme_aconn_t *conn, const void *msg, int32_t bytes,
+                  int32_t with_data, bme_reply_cb cb, void *user)
+{
+  pending_t *p = conn->spare;
+
+  if (p)
+  {
+    conn->spare = p->next;
+  }
+  else if ((p = malloc(sizeof *p)) == 0)
+  {
+    return -1;
+  }
+
+  /* Zero is left for packets that expect no reply */
+  if (++conn->next_reqid == 0)
+  {
+    conn->next_reqid = 1;
+  }
+  if (aconn_watch(conn) == -1 ||
+      aconn_send(conn, conn->next_reqid, msg, bytes) == -1)
+  {
+    p->next = conn->spare;
+    conn->spare = p;
+    return -1;
+  }
+
+  p->next = 0;
+  p->reqid = conn->next_reqid;
+  p->cb = cb;
+  p->user = user;
+  p->with_data = with_data;
+  p->have_status = 0;
+  p->status = -1;
+
+  if (conn->tail)
+  {
+    conn->tail->next = p;
+  }
+  else
+  {
+    conn->head = p;
+  }
+  conn->tail = p;
+  return 0;
+}
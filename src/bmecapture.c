@@ -0,0 +1,111 @@
+/**
+   @file bmecapture.c
+
+   @brief BME IPC traffic capture
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+
+#include "bmeipc.h"
+#include "bmeipc-internal.h"
+#include "bmecapture.h"
+
+/**
+ * Capture file descriptor, -1 when not capturing
+ */
+static int capture_fd = -1;
+
+int32_t
+bmeipc_capture_start(const char *path)
+{
+  bmecap_file_header_t head = {
+    .magic = BMECAP_MAGIC,
+    .version = BMECAP_VERSION,
+  };
+  int fd;
+
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC | O_NOFOLLOW, 0644);
+  if (fd == -1)
+  {
+    log_warn_F("%s: open: %s\n", path, strerror(errno));
+    return -1;
+  }
+  if (TEMP_FAILURE_RETRY(write(fd, &head, sizeof head)) != sizeof head)
+  {
+    log_warn_F("%s: write: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  bmeipc_capture_stop();
+  __atomic_store_n(&capture_fd, fd, __ATOMIC_RELEASE);
+  return 0;
+}
+
+void
+bmeipc_capture_stop(void)
+{
+  int fd = __atomic_exchange_n(&capture_fd, -1, __ATOMIC_ACQ_REL);
+
+  if (fd != -1)
+  {
+    close(fd);
+  }
+}
+
+void
+_bme_capture(int fd, int dir, const void *msg, int bytes)
+{
+  int cfd = __atomic_load_n(&capture_fd, __ATOMIC_ACQUIRE);
+  bmecap_record_t rec;
+  struct timeval tv;
+  struct iovec iov[2];
+  int saved = errno;
+
+  if (cfd == -1)
+  {
+    return;
+  }
+
+  _bme_getmonotime(&tv);
+  memset(&rec, 0, sizeof rec);
+  rec.usec = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+  rec.fd = fd;
+  rec.dir = dir;
+  rec.size = bytes;
+
+  iov[0].iov_base = &rec;
+  iov[0].iov_len = sizeof rec;
+  iov[1].iov_base = (void *)msg;
+  iov[1].iov_len = bytes;
+
+  /* One O_APPEND writev per record keeps records from different
+   * threads from interleaving */
+  if (writev(cfd, iov, 2) != (ssize_t) (sizeof rec + bytes))
+  {
+    log_warn_F("capture write: %s\n", strerror(errno));
+  }
+  errno = saved;
+}
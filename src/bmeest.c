@@ -0,0 +1,240 @@
+/**
+   @file bmeest.c
+
+   @brief Smoothed battery level, discharge rate and time left
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Each quantity is an exponentially weighted least squares fit kept as
+ * five decayed sums. Times are measured from the newest sample, so
+ * every new sample first shifts the sums to its own time and decays
+ * them, and then enters at t = 0. This keeps the sums small however
+ * long the estimator runs, and the fitted intercept is the smoothed
+ * value at the newest sample.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "bmeipc.h"
+#include "bmemsg.h"
+#include "bmeest.h"
+
+/* Shortest sample span a rate is estimated from, in seconds */
+#define MIN_SPAN 60
+
+/* Slower rates, in units per second, count as no change */
+#define MIN_RATE 1e-6
+
+typedef struct
+{
+  double w, t, y, tt, ty;       // decayed sums of 1, t, y, t^2, t*y
+  int64_t first, last;          // time of oldest and newest sample
+  uint32_t n;
+} fit_t;
+
+struct bmeest_s
+{
+  double lambda;                // decay per second
+  int64_t last;
+  int32_t charging;
+  fit_t level;
+  fit_t voltage;
+};
+
+static void
+fit_add(fit_t *f, double lambda, int64_t when, double y)
+{
+  if (f->n)
+  {
+    double dt = when - f->last;
+    double k = exp(-lambda * dt);
+
+    /* Move the origin to @when, then age the old samples */
+    f->tt = k * (f->tt - 2 * dt * f->t + dt * dt * f->w);
+    f->ty = k * (f->ty - dt * f->y);
+    f->t = k * (f->t - dt * f->w);
+    f->y *= k;
+    f->w *= k;
+  }
+  else
+  {
+    f->first = when;
+  }
+  f->w += 1;
+  f->y += y;
+  f->last = when;
+  f->n++;
+}
+
+/**
+ * Evaluate a fit at @when
+ *
+ * @return 1 if the rate is known, 0 if only the value is
+ */
+static int
+fit_eval(const fit_t *f, int64_t when, double *value, double *rate)
+{
+  double den = f->w * f->tt - f->t * f->t;
+
+  if (f->n < 2 || f->last - f->first < MIN_SPAN || den <= 0)
+  {
+    *value = f->y / f->w;
+    *rate = 0;
+    return 0;
+  }
+  *rate = (f->w * f->ty - f->t * f->y) / den;
+  *value = (f->y - *rate * f->t) / f->w + *rate * (when - f->last);
+  return 1;
+}
+
+/**
+ * Minutes until @from reaches @to at @rate per second
+ */
+static int32_t
+minutes_until(double from, double to, double rate)
+{
+  double m = (to - from) / rate / 60;
+
+  if (m <= 0)
+  {
+    return 0;
+  }
+  return m < INT32_MAX ? (int32_t) (m + 0.5) : INT32_MAX;
+}
+
+bmeest_t *
+bmeest_new(int32_t halflife)
+{
+  bmeest_t *est;
+
+  if (halflife < 0)
+  {
+    errno = EINVAL;
+    return 0;
+  }
+  if ((est = calloc(1, sizeof *est)) == 0)
+  {
+    return 0;
+  }
+  est->lambda = M_LN2 / (halflife ? halflife : BMEEST_HALFLIFE);
+  return est;
+}
+
+void
+bmeest_free(bmeest_t *est)
+{
+  free(est);
+}
+
+void
+bmeest_reset(bmeest_t *est)
+{
+  memset(&est->level, 0, sizeof est->level);
+  memset(&est->voltage, 0, sizeof est->voltage);
+  est->last = 0;
+  est->charging = 0;
+}
+
+int32_t
+bmeest_add(bmeest_t *est, int64_t when, const bmestat_t *stat,
+           const struct emsg_battery_info_reply *info)
+{
+  if ((est->level.n || est->voltage.n) && when < est->last)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (stat)
+  {
+    int32_t charging =
+      (*stat)[CHARGER_STATE] == CHARGER_STATE_CONNECTED;
+
+    /* Rates while charging say nothing about discharging, and back */
+    if (charging != est->charging)
+    {
+      bmeest_reset(est);
+      est->charging = charging;
+    }
+    fit_add(&est->level, est->lambda, when, (*stat)[BATTERY_LEVEL_PCT]);
+  }
+  if (info && (info->flags & BME_BATTERY_VOLTAGE))
+  {
+    fit_add(&est->voltage, est->lambda, when, info->voltage);
+  }
+  est->last = when;
+  return 0;
+}
+
+int32_t
+bmeest_query(const bmeest_t *est, int64_t when, bmeest_result_t *res)
+{
+  double rate;
+
+  memset(res, 0, sizeof *res);
+  res->charging = est->charging;
+
+  if (est->voltage.n)
+  {
+    res->valid |= BMEEST_VOLTAGE;
+    if (fit_eval(&est->voltage, when, &res->voltage, &rate))
+    {
+      res->voltage_rate = rate * 3600;
+      res->valid |= BMEEST_VOLTAGE_RATE;
+    }
+  }
+
+  if (est->level.n == 0)
+  {
+    return 0;
+  }
+  res->valid |= BMEEST_LEVEL;
+  if (!fit_eval(&est->level, when, &res->level, &rate))
+  {
+    return 0;
+  }
+  res->level_rate = rate * 3600;
+  res->valid |= BMEEST_LEVEL_RATE;
+
+  /* Keep extrapolation within what the server could report */
+  if (res->level < 0)
+  {
+    res->level = 0;
+  }
+  if (res->level > 100)
+  {
+    res->level = 100;
+  }
+
+  if (!est->charging && rate < -MIN_RATE)
+  {
+    res->time_left = minutes_until(res->level, 0, rate);
+    res->valid |= BMEEST_TIME_LEFT;
+  }
+  if (est->charging && rate > MIN_RATE)
+  {
+    res->time_full = minutes_until(res->level, 100, rate);
+    res->valid |= BMEEST_TIME_FULL;
+  }
+  return 0;
+}
@@ -0,0 +1,344 @@
+/**
+   @file bmeframe.c
+
+   @brief BME IPC framing parser
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "bmeipc.h"
+#include "bmeipc-internal.h"
+#include "bmeframe.h"
+
+enum
+{
+  STATE_HEADER,
+  STATE_DATA,
+  STATE_ERROR,
+};
+
+int32_t
+bmeipc_frame_decode(const void *buf, size_t len, int32_t max,
+                    bmeipc_frame_t *frame, int32_t *size)
+{
+  bmeipc_header_v2 head;
+
+  if (len < sizeof head.base)
+  {
+    return 0;
+  }
+  memcpy(&head.base, buf, sizeof head.base);
+
+  if (head.base.sync == BMEIPC_SYNCWORD_V2)
+  {
+    if (len < sizeof head)
+    {
+      return 0;
+    }
+    memcpy(&head, buf, sizeof head);
+  }
+  else if (head.base.sync != BMEIPC_SYNCWORD)
+  {
+    errno = EBADMSG;
+    return -1;
+  }
+  if (head.base.size < 0 || head.base.size > max)
+  {
+    errno = EBADMSG;
+    return -1;
+  }
+
+  if (frame)
+  {
+    if (head.base.sync == BMEIPC_SYNCWORD_V2)
+    {
+      frame->version = 2;
+      frame->reqid = head.reqid;
+      frame->type = head.type;
+      frame->flags = head.flags;
+    }
+    else
+    {
+      memset(frame, 0, sizeof *frame);
+      frame->version = 1;
+    }
+  }
+  *size = head.base.size;
+
+  return head.base.sync == BMEIPC_SYNCWORD_V2 ? sizeof head : sizeof head.base;
+}
+
+void
+bmeipc_parser_init(bmeipc_parser_t *parser, int32_t max)
+{
+  memset(parser, 0, sizeof *parser);
+  parser->state = STATE_HEADER;
+  parser->max = max > 0 ? max : BMEIPC_PAYLOAD_MAX;
+}
+
+/**
+ * Collect header bytes until a whole header is present
+ */
+static int32_t
+parse_header(bmeipc_parser_t *p, const unsigned char *buf, size_t len,
+             size_t *used, bmeipc_parse_event_t *ev)
+{
+  int32_t hlen;
+
+  /* Common case: nothing collected and the header is all there */
+  if (p->have == 0)
+  {
+    hlen = bmeipc_frame_decode(buf, len, p->max, &ev->frame, &ev->size);
+    if (hlen > 0)
+    {
+      *used = hlen;
+      goto done;
+    }
+    if (hlen == -1)
+    {
+      goto fail;
+    }
+  }
+
+  /* Collect up to the base header first, then up to the v2 header if
+   * the sync word asks for it; never take payload bytes */
+  while (len > 0)
+  {
+    size_t want = sizeof(bmeipc_header);
+    size_t n;
+
+    if (p->have >= want)
+    {
+      want = BMEIPC_HEADER_MAX;
+    }
+    n = want - p->have < len ? want - p->have : len;
+    memcpy(p->head + p->have, buf, n);
+    p->have += n;
+    *used += n;
+    buf += n;
+    len -= n;
+
+    hlen = bmeipc_frame_decode(p->head, p->have, p->max, &ev->frame,
+                               &ev->size);
+    if (hlen > 0)
+    {
+      p->have = 0;
+      goto done;
+    }
+    if (hlen == -1)
+    {
+      goto fail;
+    }
+  }
+  return BMEIPC_PARSE_MORE;
+
+done:
+  p->left = ev->size;
+  if (p->left > 0)
+  {
+    p->state = STATE_DATA;
+  }
+  return BMEIPC_PARSE_HEADER;
+
+fail:
+  p->state = STATE_ERROR;
+  return BMEIPC_PARSE_ERROR;
+}
+
+int32_t
+bmeipc_parse(bmeipc_parser_t *parser, const void *buf, size_t len,
+             size_t *used, bmeipc_parse_event_t *ev)
+{
+  size_t n;
+
+  *used = 0;
+
+  switch (parser->state)
+  {
+  case STATE_HEADER:
+    return parse_header(parser, buf, len, used, ev);
+
+  case STATE_DATA:
+    if (len == 0)
+    {
+      return BMEIPC_PARSE_MORE;
+    }
+    n = (size_t) parser->left < len ? (size_t) parser->left : len;
+    parser->left -= n;
+    if (parser->left == 0)
+    {
+      parser->state = STATE_HEADER;
+    }
+    ev->data = buf;
+    ev->bytes = n;
+    ev->last = parser->left == 0;
+    *used = n;
+    return BMEIPC_PARSE_DATA;
+
+  default:
+    errno = EBADMSG;
+    return BMEIPC_PARSE_ERROR;
+  }
+}
+
+int32_t
+bmeipc_cookie_check(const void *data, int32_t bytes, const char *cookie)
+{
+  size_t len = strlen(cookie);
+
+  if (len > BMEIPC_COOKIE_MAX)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  if (bytes != (int32_t) len || memcmp(data, cookie, len))
+  {
+    errno = EACCES;
+    return -1;
+  }
+  return 0;
+}
+
+int32_t
+bmeipc_ack_version(const void *data, int32_t bytes)
+{
+  if (bytes != 1)
+  {
+    errno = EBADMSG;
+    return -1;
+  }
+  return *(const char *)data == BMEIPC_ACK_V2[0] ? 2 : 1;
+}
+
+int32_t
+_bme_rx_init(bmeipc_rx_t *rx, size_t cap, int32_t max)
+{
+  memset(rx, 0, sizeof *rx);
+  if ((rx->buf = malloc(cap)) == 0)
+  {
+    return -1;
+  }
+  rx->cap = cap;
+  bmeipc_parser_init(&rx->parser, max);
+  return 0;
+}
+
+void
+_bme_rx_free(bmeipc_rx_t *rx)
+{
+  free(rx->buf);
+  rx->buf = 0;
+}
+
+char *
+_bme_rx_space(bmeipc_rx_t *rx, size_t min, size_t *room)
+{
+  size_t cap = rx->cap;
+
+  /* The frame being collected must fit whole */
+  if (rx->collecting && cap < rx->start + rx->size)
+  {
+    cap = rx->start + rx->size;
+  }
+  while (cap - rx->len < min)
+  {
+    cap *= 2;
+  }
+  if (cap != rx->cap)
+  {
+    char *p = realloc(rx->buf, cap);
+
+    if (p == 0)
+    {
+      return 0;
+    }
+    rx->buf = p;
+    rx->cap = cap;
+  }
+  *room = rx->cap - rx->len;
+  return rx->buf + rx->len;
+}
+
+int32_t
+_bme_rx_next(bmeipc_rx_t *rx, bmeipc_frame_t *frame, char **data,
+             int32_t *size)
+{
+  for (;;)
+  {
+    bmeipc_parse_event_t ev;
+    size_t used;
+    int32_t rc = bmeipc_parse(&rx->parser, rx->buf + rx->off,
+                              rx->len - rx->off, &used, &ev);
+
+    rx->off += used;
+    switch (rc)
+    {
+    case BMEIPC_PARSE_ERROR:
+      return -1;
+
+    case BMEIPC_PARSE_MORE:
+      return 0;
+
+    case BMEIPC_PARSE_HEADER:
+      rx->frame = ev.frame;
+      rx->size = ev.size;
+      rx->start = rx->off;
+      rx->collecting = ev.size > 0;
+      if (rx->collecting)
+      {
+        break;
+      }
+      goto done;
+
+    case BMEIPC_PARSE_DATA:
+      if (!ev.last)
+      {
+        break;
+      }
+      rx->collecting = 0;
+      goto done;
+    }
+  }
+
+done:
+  *frame = rx->frame;
+  *data = rx->buf + rx->start;
+  *size = rx->size;
+  return 1;
+}
+
+void
+_bme_rx_compact(bmeipc_rx_t *rx)
+{
+  size_t keep = rx->collecting ? rx->start : rx->off;
+
+  if (keep == 0)
+  {
+    return;
+  }
+  memmove(rx->buf, rx->buf + keep, rx->len - keep);
+  rx->len -= keep;
+  rx->off -= keep;
+  if (rx->collecting)
+  {
+    rx->start = 0;
+  }
+}
@@ -0,0 +1,654 @@
+/**
+   @file bmehist.c
+
+   @brief BME battery history recorder with rollup queries
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Samples are kept in arrival order and folded into per-minute,
+ * per-hour and per-day buckets as they are added. A query is split
+ * into the partial minutes at its ends (answered from raw samples),
+ * the partial hours (minute buckets), the partial days (hour buckets)
+ * and whole days. Whole days are answered in constant time from
+ * running sums and a sparse table of min/max that is extended as the
+ * last day bucket changes.
+ *
+ * With a maximum age set, raw samples are dropped in whole minutes once
+ * they are older than that; the buckets still hold them, so queries
+ * reaching back there are answered in whole minutes.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include "bmeipc.h"
+#include "bmemsg.h"
+#include "bmehist.h"
+
+#define SPARSE_LEVELS 32
+
+/* Rollup units, raw samples being the finest one */
+enum
+{
+  UNIT_RAW = 0,
+  UNIT_MINUTE,
+  UNIT_HOUR,
+  UNIT_DAY,
+  UNIT_COUNT
+};
+
+static const int64_t unit_span[UNIT_COUNT] = { 1, 60, 60 * 60, 24 * 60 * 60 };
+
+typedef struct
+{
+  int64_t sum;
+  uint32_t count;
+  int32_t min;
+  int32_t max;
+} agg_t;
+
+typedef struct
+{
+  agg_t a[BMEHIST_METRICS];
+} aggset_t;
+
+typedef struct
+{
+  int64_t when;
+  uint32_t valid;               // bit per bmehist_metric_e
+  int32_t v[BMEHIST_METRICS];
+} sample_t;
+
+typedef struct
+{
+  int64_t start;
+  aggset_t agg;
+} bucket_t;
+
+typedef struct
+{
+  bucket_t *b;
+  size_t n, cap;
+} level_t;
+
+struct bmehist_s
+{
+  sample_t *raw;
+  size_t nraw, rawcap;
+  int64_t first, last;          // time of first and last sample
+  int64_t rawfrom;              // raw samples before this were dropped
+  int64_t max_age;              // raw sample lifetime, 0 for no limit
+
+  /* minute, hour and day buckets, indexed by unit - 1 */
+  level_t lvl[UNIT_COUNT - 1];
+
+  /* sum/count of days [0, i] */
+  aggset_t *cum;
+  size_t cumcap;
+
+  /* min/max of days [j, j + 2^k), k >= 1 */
+  aggset_t *st[SPARSE_LEVELS];
+  size_t stcap[SPARSE_LEVELS];
+};
+
+/**
+ * Make room for at least @need elements
+ */
+static int
+grow(void *pptr, size_t *cap, size_t need, size_t elem)
+{
+  void **ptr = pptr;
+  size_t ncap = *cap ? *cap : 16;
+  void *p;
+
+  if (need <= *cap)
+  {
+    return 0;
+  }
+  while (ncap < need)
+  {
+    ncap *= 2;
+  }
+  if ((p = realloc(*ptr, ncap * elem)) == 0)
+  {
+    return -1;
+  }
+  *ptr = p;
+  *cap = ncap;
+  return 0;
+}
+
+static int64_t
+floor_to(int64_t t, int64_t span)
+{
+  int64_t q = t / span;
+  if (t % span < 0)
+  {
+    q--;
+  }
+  return q * span;
+}
+
+static int64_t
+ceil_to(int64_t t, int64_t span)
+{
+  int64_t f = floor_to(t, span);
+  return f == t ? f : f + span;
+}
+
+static void
+agg_add(agg_t *a, int32_t v)
+{
+  if (a->count == 0)
+  {
+    a->min = a->max = v;
+  }
+  else
+  {
+    if (v < a->min)
+      a->min = v;
+    if (v > a->max)
+      a->max = v;
+  }
+  a->sum += v;
+  a->count++;
+}
+
+static void
+agg_merge(agg_t *a, const agg_t *b)
+{
+  if (b->count == 0)
+  {
+    return;
+  }
+  if (a->count == 0)
+  {
+    *a = *b;
+    return;
+  }
+  if (b->min < a->min)
+    a->min = b->min;
+  if (b->max > a->max)
+    a->max = b->max;
+  a->sum += b->sum;
+  a->count += b->count;
+}
+
+/**
+ * Index of first raw sample at or after @when
+ */
+static size_t
+raw_lower_bound(const bmehist_t *h, int64_t when)
+{
+  size_t lo = 0, hi = h->nraw;
+
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (h->raw[mid].when < when)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/**
+ * Index of first bucket starting at or after @when
+ */
+static size_t
+bucket_lower_bound(const level_t *l, int64_t when)
+{
+  size_t lo = 0, hi = l->n;
+
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (l->b[mid].start < when)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/**
+ * Does @when need a new bucket in @l
+ */
+static int
+level_new(const level_t *l, int64_t when, int64_t span)
+{
+  return l->n == 0 || l->b[l->n - 1].start != floor_to(when, span);
+}
+
+/**
+ * Get the bucket @when falls in, appending one if needed; room for it
+ * must have been made by hist_reserve()
+ */
+static bucket_t *
+level_touch(level_t *l, int64_t when, int64_t span)
+{
+  bucket_t *b;
+
+  if (!level_new(l, when, span))
+  {
+    return &l->b[l->n - 1];
+  }
+  b = &l->b[l->n++];
+  memset(b, 0, sizeof *b);
+  b->start = floor_to(when, span);
+  return b;
+}
+
+static const aggset_t *
+sparse_get(const bmehist_t *h, int k, size_t j)
+{
+  return k ? &h->st[k][j] : &h->lvl[UNIT_DAY - 1].b[j].agg;
+}
+
+/**
+ * Refresh running sums and sparse table entries that cover the last day
+ */
+static void
+day_refresh(bmehist_t *h)
+{
+  const level_t *days = &h->lvl[UNIT_DAY - 1];
+  size_t i = days->n - 1;
+  int k, m;
+
+  for (m = 0; m < BMEHIST_METRICS; m++)
+  {
+    agg_t *c = &h->cum[i].a[m];
+    const agg_t *d = &days->b[i].agg.a[m];
+
+    c->sum = (i ? h->cum[i - 1].a[m].sum : 0) + d->sum;
+    c->count = (i ? h->cum[i - 1].a[m].count : 0) + d->count;
+  }
+
+  for (k = 1; k < SPARSE_LEVELS && ((size_t)1 << k) <= i + 1; k++)
+  {
+    size_t j = i + 1 - ((size_t)1 << k);
+    size_t half = (size_t)1 << (k - 1);
+
+    h->st[k][j] = *sparse_get(h, k - 1, j);
+    for (m = 0; m < BMEHIST_METRICS; m++)
+    {
+      agg_merge(&h->st[k][j].a[m], &sparse_get(h, k - 1, j + half)->a[m]);
+    }
+  }
+}
+
+/**
+ * Make room for a sample at @when in every array, so that adding it
+ * cannot fail halfway
+ */
+static int
+hist_reserve(bmehist_t *h, int64_t when)
+{
+  size_t ndays;
+  int u, k;
+
+  if (grow(&h->raw, &h->rawcap, h->nraw + 1, sizeof *h->raw) == -1)
+  {
+    return -1;
+  }
+  for (u = UNIT_MINUTE; u < UNIT_COUNT; u++)
+  {
+    level_t *l = &h->lvl[u - 1];
+
+    if (grow(&l->b, &l->cap, l->n + 1, sizeof *l->b) == -1)
+    {
+      return -1;
+    }
+  }
+
+  ndays = h->lvl[UNIT_DAY - 1].n +
+    level_new(&h->lvl[UNIT_DAY - 1], when, unit_span[UNIT_DAY]);
+  if (grow(&h->cum, &h->cumcap, ndays, sizeof *h->cum) == -1)
+  {
+    return -1;
+  }
+  for (k = 1; k < SPARSE_LEVELS && ((size_t)1 << k) <= ndays; k++)
+  {
+    if (grow(&h->st[k], &h->stcap[k], ndays + 1 - ((size_t)1 << k),
+             sizeof *h->st[k]) == -1)
+    {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Drop raw samples past the maximum age, in whole minutes
+ */
+static void
+raw_trim(bmehist_t *h)
+{
+  int64_t cut;
+  size_t n;
+
+  if (h->max_age <= 0)
+  {
+    return;
+  }
+  cut = floor_to(h->last - h->max_age, unit_span[UNIT_MINUTE]);
+  n = raw_lower_bound(h, cut);
+
+  /* Compact only once half the samples are stale, so that trimming
+   * costs constant time per sample */
+  if (n == 0 || n < h->nraw / 2)
+  {
+    return;
+  }
+  memmove(h->raw, h->raw + n, (h->nraw - n) * sizeof *h->raw);
+  h->nraw -= n;
+  h->rawfrom = cut;
+}
+
+static int
+hist_add(bmehist_t *h, int64_t when, uint32_t valid, const int32_t *v)
+{
+  sample_t *s;
+  int u, m;
+
+  if (h->lvl[0].n && when < h->last)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  if (valid == 0)
+  {
+    return 0;
+  }
+  if (hist_reserve(h, when) == -1)
+  {
+    return -1;
+  }
+
+  if (h->lvl[0].n == 0)
+  {
+    h->first = when;
+  }
+  h->last = when;
+
+  s = &h->raw[h->nraw++];
+  s->when = when;
+  s->valid = valid;
+  memcpy(s->v, v, sizeof s->v);
+
+  for (u = UNIT_MINUTE; u < UNIT_COUNT; u++)
+  {
+    bucket_t *b = level_touch(&h->lvl[u - 1], when, unit_span[u]);
+
+    for (m = 0; m < BMEHIST_METRICS; m++)
+    {
+      if (valid & (1u << m))
+      {
+        agg_add(&b->agg.a[m], v[m]);
+      }
+    }
+  }
+  day_refresh(h);
+
+  raw_trim(h);
+  return 0;
+}
+
+bmehist_t *
+bmehist_new(void)
+{
+  bmehist_t *h = calloc(1, sizeof(bmehist_t));
+
+  if (h)
+  {
+    h->rawfrom = INT64_MIN;
+  }
+  return h;
+}
+
+int32_t
+bmehist_set_max_age(bmehist_t *hist, int64_t seconds)
+{
+  if (seconds < 0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  hist->max_age = seconds;
+  return 0;
+}
+
+void
+bmehist_free(bmehist_t *hist)
+{
+  int i;
+
+  if (hist == 0)
+  {
+    return;
+  }
+  for (i = 0; i < UNIT_COUNT - 1; i++)
+  {
+    free(hist->lvl[i].b);
+  }
+  for (i = 0; i < SPARSE_LEVELS; i++)
+  {
+    free(hist->st[i]);
+  }
+  free(hist->cum);
+  free(hist->raw);
+  free(hist);
+}
+
+int32_t
+bmehist_add(bmehist_t *hist, int64_t when, const bmestat_t *stat,
+            const struct emsg_battery_info_reply *info)
+{
+  int32_t v[BMEHIST_METRICS] = { 0 };
+  uint32_t valid = 0;
+
+  if (stat)
+  {
+    v[BMEHIST_LEVEL_PCT] = (*stat)[BATTERY_LEVEL_PCT];
+    valid |= 1u << BMEHIST_LEVEL_PCT;
+  }
+  if (info && (info->flags & BME_BATTERY_VOLTAGE))
+  {
+    v[BMEHIST_VOLTAGE] = info->voltage;
+    valid |= 1u << BMEHIST_VOLTAGE;
+  }
+  if (info && (info->flags & BME_BATTERY_TEMP))
+  {
+    v[BMEHIST_TEMP] = info->temp;
+    valid |= 1u << BMEHIST_TEMP;
+  }
+
+  return hist_add(hist, when, valid, v);
+}
+
+int32_t
+bmehist_add_value(bmehist_t *hist, int64_t when, int32_t metric,
+                  int32_t value)
+{
+  int32_t v[BMEHIST_METRICS] = { 0 };
+
+  if (metric < 0 || metric >= BMEHIST_METRICS)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  v[metric] = value;
+  return hist_add(hist, when, 1u << metric, v);
+}
+
+/**
+ * Accumulate raw samples or buckets of @unit within [from, to)
+ */
+static void
+unit_scan(const bmehist_t *h, int unit, int m, int64_t from, int64_t to,
+          agg_t *acc)
+{
+  size_t i;
+
+  if (unit == UNIT_RAW)
+  {
+    for (i = raw_lower_bound(h, from);
+         i < h->nraw && h->raw[i].when < to; i++)
+    {
+      if (h->raw[i].valid & (1u << m))
+      {
+        agg_add(acc, h->raw[i].v[m]);
+      }
+    }
+  }
+  else
+  {
+    const level_t *l = &h->lvl[unit - 1];
+
+    for (i = bucket_lower_bound(l, from); i < l->n && l->b[i].start < to; i++)
+    {
+      agg_merge(acc, &l->b[i].agg.a[m]);
+    }
+  }
+}
+
+/**
+ * Accumulate whole days within [from, to) in constant time
+ */
+static void
+day_range(const bmehist_t *h, int m, int64_t from, int64_t to, agg_t *acc)
+{
+  const level_t *days = &h->lvl[UNIT_DAY - 1];
+  size_t i = bucket_lower_bound(days, from);
+  size_t j = bucket_lower_bound(days, to);
+  agg_t r;
+  int k = 0;
+
+  if (i >= j)
+  {
+    return;
+  }
+
+  r.sum = h->cum[j - 1].a[m].sum - (i ? h->cum[i - 1].a[m].sum : 0);
+  r.count = h->cum[j - 1].a[m].count - (i ? h->cum[i - 1].a[m].count : 0);
+  if (r.count == 0)
+  {
+    return;
+  }
+
+  while (((size_t)2 << k) <= j - i)
+  {
+    k++;
+  }
+  {
+    agg_t lo = sparse_get(h, k, i)->a[m];
+    agg_merge(&lo, &sparse_get(h, k, j - ((size_t)1 << k))->a[m]);
+    r.min = lo.min;
+    r.max = lo.max;
+  }
+
+  agg_merge(acc, &r);
+}
+
+/**
+ * Accumulate [from, to), both aligned to @unit
+ */
+static void
+range_query(const bmehist_t *h, int unit, int m, int64_t from, int64_t to,
+            agg_t *acc)
+{
+  int64_t next, a, b;
+
+  if (from >= to)
+  {
+    return;
+  }
+  if (unit == UNIT_DAY)
+  {
+    day_range(h, m, from, to, acc);
+    return;
+  }
+
+  next = unit_span[unit + 1];
+  a = ceil_to(from, next);
+  b = floor_to(to, next);
+
+  if (a >= b)
+  {
+    unit_scan(h, unit, m, from, to, acc);
+    return;
+  }
+  unit_scan(h, unit, m, from, a, acc);
+  unit_scan(h, unit, m, b, to, acc);
+  range_query(h, unit + 1, m, a, b, acc);
+}
+
+int32_t
+bmehist_query(const bmehist_t *hist, int32_t metric,
+              int64_t from, int64_t to, bmehist_result_t *res)
+{
+  agg_t acc = { 0 };
+
+  if (metric < 0 || metric >= BMEHIST_METRICS || res == 0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(res, 0, sizeof *res);
+  if (hist->lvl[0].n == 0)
+  {
+    return 0;
+  }
+
+  /* Clip to recorded history so that alignment arithmetic stays sane */
+  if (from < hist->first)
+  {
+    from = hist->first;
+  }
+  if (to > hist->last + 1)
+  {
+    to = hist->last + 1;
+  }
+
+  /* Without raw samples, ends fall on whole minutes */
+  if (from < hist->rawfrom)
+  {
+    from = floor_to(from, unit_span[UNIT_MINUTE]);
+  }
+  if (to < hist->rawfrom)
+  {
+    to = ceil_to(to, unit_span[UNIT_MINUTE]);
+  }
+
+  range_query(hist, UNIT_RAW, metric, from, to, &acc);
+
+  if (acc.count)
+  {
+    res->count = acc.count;
+    res->min = acc.min;
+    res->max = acc.max;
+    res->sum = acc.sum;
+    res->avg = (double)acc.sum / acc.count;
+  }
+  return 0;
+}
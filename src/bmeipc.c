@@ -31,7 +31,9 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/poll.h>
+#include <sys/uio.h>
 #include <stdarg.h>
+#include <string.h>
 
 #include <time.h>
 #include <sys/time.h>
@@ -40,12 +42,23 @@
 
 #include "bmeipc.h"
 #include "bmeipc-internal.h"
+#include "bmecapture.h"
+#include "bmeframe.h"
+#include "bmearena.h"
+#include "bmeipc-probes.h"
+
+#ifdef HAVE_SYS_SDT_H
+# define BME_PROBE_DEFINE(name) \
+  unsigned short BME_PROBE_SEMAPHORE(name) \
+    __attribute__ ((section(".probes"), visibility("hidden"))) = 0;
+BME_PROBE_NAMES(BME_PROBE_DEFINE)
+#endif
 
 /**
  * Get time stamp that is not affected by system time changes 
  */
-static void
-getmonotime(struct timeval *tv)
+void
+_bme_getmonotime(struct timeval *tv)
 {
   struct timespec t;
   if (clock_gettime(CLOCK_MONOTONIC, &t) == 0)
@@ -61,28 +74,28 @@ getmonotime(struct timeval *tv)
 /**
  * Set timeout given milliseconds in to future 
  */
-static void
-settimeout(struct timeval *timeout, int msec)
+void
+_bme_settimeout(struct timeval *timeout, int msec)
 {
   struct timeval s = {
     .tv_sec = (msec / 1000),
     .tv_usec = (msec % 1000) * 1000,
   };
 
-  getmonotime(timeout);
+  _bme_getmonotime(timeout);
   timeradd(timeout, &s, timeout);
 }
 
 /**
  * Return milliseconds left to timeout 
  */
-static int
-msecsto(const struct timeval *timeout)
+int
+_bme_msecsto(const struct timeval *timeout)
 {
   struct timeval t;
   int msec = 0;
 
-  getmonotime(&t);
+  _bme_getmonotime(&t);
 
   if (timercmp(&t, timeout, <))
   {
@@ -93,20 +106,6 @@ msecsto(const struct timeval *timeout)
   return msec;
 }
 
-/**
- * BME packet header structure
- */
-typedef struct
-{
-  int sync;                     // sync pattern for detecting broken packets
-  int size;                     // size of actual packet data after the header
-} bmeipc_header;
-
-/**
- * Sync pattern for packet header
- */
-#define BMEIPC_SYNCWORD 0x434e5953
-
 /**
  * Pointer to vsyslog() compatible logging function used by bmeipc.
  */
@@ -121,12 +120,8 @@ static void (*log_message_fn) (int, const char *, va_list) = vsyslog;
  * @fmt:   printf style format string
  * @...:   appropriate arguments for the format string
  */
-
-static void log_message(int level, const char *fmt, ...)
-  __attribute__ ((format(printf, 2, 3)));
-
-static void
-log_message(int level, const char *fmt, ...)
+void
+_bme_log_message(int level, const char *fmt, ...)
 {
   if (log_message_fn != 0)
   {
@@ -137,11 +132,176 @@ log_message(int level, const char *fmt, ...)
   }
 }
 
-#define log_warn_F(FMT, ARG...)\
-    log_message(LOG_WARNING, "%s: "FMT, __FUNCTION__, ## ARG)
+/* Sockets with spin-then-block reads; only a few are expected */
+#define SPIN_SLOTS 8
+
+typedef struct
+{
+  int key;                      // fd + 1, 0 = free slot
+  int usec;                     // spin time of blocking reads
+} spin_slot_t;
+
+static spin_slot_t spin_slots[SPIN_SLOTS];
+static int spin_used = 0;
+static int spin_cpus = 0;       // online CPUs, 0 = not asked yet
+
+/**
+ * Number of online CPUs, asked from the system once
+ */
+static int
+spin_cpu_count(void)
+{
+  int n = __atomic_load_n(&spin_cpus, __ATOMIC_RELAXED);
+
+  if (n == 0)
+  {
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+    {
+      n = 1;
+    }
+    __atomic_store_n(&spin_cpus, n, __ATOMIC_RELAXED);
+  }
+  return n;
+}
+
+/**
+ * Spin time of blocking reads on a socket
+ *
+ * @fd: socket descriptor
+ *
+ * @return microseconds, 0 = always poll
+ */
+static int
+read_spin_get(int fd)
+{
+  int i;
+
+  if (__atomic_load_n(&spin_used, __ATOMIC_RELAXED) == 0)
+  {
+    return 0;
+  }
+  for (i = 0; i < SPIN_SLOTS; i++)
+  {
+    if (__atomic_load_n(&spin_slots[i].key, __ATOMIC_ACQUIRE) == fd + 1)
+    {
+      return __atomic_load_n(&spin_slots[i].usec, __ATOMIC_RELAXED);
+    }
+  }
+  return 0;
+}
+
+int32_t
+bmeipc_set_read_spin(int32_t fd, int32_t usec)
+{
+  int i, prev;
+
+  if (fd < 0)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  /* With one CPU the spinner only delays the server it waits for */
+  if (usec < 0 || (usec > 0 && spin_cpu_count() < 2))
+  {
+    usec = 0;
+  }
+
+  for (i = 0; i < SPIN_SLOTS; i++)
+  {
+    spin_slot_t *s = &spin_slots[i];
+
+    if (__atomic_load_n(&s->key, __ATOMIC_ACQUIRE) != fd + 1)
+    {
+      continue;
+    }
+    prev = __atomic_load_n(&s->usec, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->usec, usec, __ATOMIC_RELAXED);
+    if (usec == 0)
+    {
+      __atomic_store_n(&s->key, 0, __ATOMIC_RELEASE);
+      __atomic_sub_fetch(&spin_used, 1, __ATOMIC_RELAXED);
+    }
+    return prev;
+  }
+
+  if (usec == 0)
+  {
+    return 0;
+  }
+  for (i = 0; i < SPIN_SLOTS; i++)
+  {
+    spin_slot_t *s = &spin_slots[i];
+    int none = 0;
+
+    if (__atomic_compare_exchange_n(&s->key, &none, fd + 1, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+    {
+      __atomic_store_n(&s->usec, usec, __ATOMIC_RELAXED);
+      __atomic_add_fetch(&spin_used, 1, __ATOMIC_RELAXED);
+      return 0;
+    }
+  }
+  errno = ENOSPC;
+  return -1;
+}
 
-#define log_error_F(FMT, ARG...)\
-    log_message(LOG_ERR, "%s: "FMT, __FUNCTION__, ## ARG)
+/**
+ * Let a spinning hardware thread yield to its sibling
+ */
+static inline void
+cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+/**
+ * Busy-poll for data without sleeping
+ *
+ * @fd: socket descriptor
+ * @msg: buffer address
+ * @bytes: buffer size
+ * @usec: how long to spin
+ *
+ * @return as recv(), -1 with errno EAGAIN if nothing arrived in time
+ */
+static int
+spin_recv(int fd, void *data, int size, int usec)
+{
+  struct timespec now, end;
+  int rc;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  end.tv_sec += usec / 1000000;
+  end.tv_nsec += (usec % 1000000) * 1000L;
+  if (end.tv_nsec >= 1000000000L)
+  {
+    end.tv_sec += 1;
+    end.tv_nsec -= 1000000000L;
+  }
+
+  for (;;)
+  {
+    rc = TEMP_FAILURE_RETRY(recv(fd, data, size, MSG_DONTWAIT));
+    if (rc != -1 || (errno != EAGAIN && errno != EWOULDBLOCK))
+    {
+      return rc;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > end.tv_sec ||
+        (now.tv_sec == end.tv_sec && now.tv_nsec >= end.tv_nsec))
+    {
+      BME_PROBE2(spin_miss, fd, usec);
+      errno = EAGAIN;
+      return -1;
+    }
+    cpu_relax();
+  }
+}
 
 /**
  * Wrapper for read with diagnostics.
@@ -153,16 +313,26 @@ log_message(int level, const char *fmt, ...)
  * @return number of bytes read, 0=EOF, -1=ERR
  */
 static int
-bme_bytes_read(int fd, void *data, int size)
+bytes_read(int fd, void *data, int size)
 {
   struct pollfd pfd = {.fd = fd,.events = POLLIN };
   struct timeval tmo;
+  int spin = read_spin_get(fd);
 
   int rc;
 
+  if (spin > 0)
+  {
+    rc = spin_recv(fd, data, size, spin);
+    if (rc != -1 || errno != EAGAIN)
+    {
+      goto done;
+    }
+  }
+
   /* Wait max 5 secs for data / EOF to come available */
-  settimeout(&tmo, 5000);
-  rc = TEMP_FAILURE_RETRY(poll(&pfd, 1, msecsto(&tmo)));
+  _bme_settimeout(&tmo, 5000);
+  rc = TEMP_FAILURE_RETRY(poll(&pfd, 1, _bme_msecsto(&tmo)));
 
   if (rc == -1)
   {
@@ -175,6 +345,7 @@ bme_bytes_read(int fd, void *data, int size)
     // set errno to something meaningful
     errno = ETIMEDOUT;
     log_warn_F("[fd=%d] poll TIMEOUT\n", fd);
+    BME_PROBE2(poll_timeout, fd, 5000);
     return -1;
   }
 
@@ -182,6 +353,7 @@ bme_bytes_read(int fd, void *data, int size)
    * block if less than expected is ready for reading */
   rc = TEMP_FAILURE_RETRY(recv(fd, data, size, MSG_DONTWAIT));
 
+done:
   if (rc == -1)
   {
     log_warn_F("[fd=%d] read ERROR: %s\n", fd, strerror(errno));
@@ -198,6 +370,17 @@ bme_bytes_read(int fd, void *data, int size)
   return rc;
 }
 
+static int
+bme_bytes_read(int fd, void *data, int size)
+{
+  int rc;
+
+  BME_PROBE2(bytes_read_entry, fd, size);
+  rc = bytes_read(fd, data, size);
+  BME_PROBE3(bytes_read_return, fd, size, rc);
+  return rc;
+}
+
 /**
  * Write a packet to the socket.
  *
@@ -222,7 +405,11 @@ bme_packet_write(int fd, const void *msg, int bytes)
   };
 
   int tot = sizeof hdr + bytes;
-  int ret = writev(fd, iov, 2);
+  int ret;
+
+  BME_PROBE3(packet_write_entry, fd,
+             BME_PROBE_TYPE(packet_write_entry, msg, bytes), bytes);
+  ret = writev(fd, iov, 2);
 
   if (ret == -1)
   {
@@ -238,8 +425,11 @@ bme_packet_write(int fd, const void *msg, int bytes)
   else
   {
     ret = bytes;
+    _bme_capture(fd, BMECAP_WRITE, msg, bytes);
   }
 
+  BME_PROBE3(packet_write_return, fd,
+             BME_PROBE_TYPE(packet_write_return, msg, bytes), ret);
   return ret;
 }
 
@@ -247,16 +437,23 @@ bme_packet_write(int fd, const void *msg, int bytes)
  * Read packet header from socket.
  *
  * @fd: socket descriptor
+ * @frame: v2 header fields of the packet, or NULL
  *
  * @return size of packet following the header, -1=Error, 0=EOF/out-of-sync
  *
  */
 static int
-bme_header_read(int fd)
+header_read(int fd, bmeipc_frame_t *frame)
 {
+  unsigned char buf[BMEIPC_HEADER_MAX];
+  bmeipc_parser_t parser;
+  bmeipc_parse_event_t ev;
   bmeipc_header head;
+  int have = sizeof head;
+  size_t used;
+  int rc;
 
-  int done = bme_bytes_read(fd, &head, sizeof head);
+  int done = bme_bytes_read(fd, buf, have);
 
   if (done == -1)
   {
@@ -268,41 +465,112 @@ bme_header_read(int fd)
     //log_warn_F("[fd=%d]: read header: %s\n", fd, "EOF");
     return 0;                   // EOF
   }
-  if (done != sizeof head)
+  if (done != have)
   {
-    log_warn_F("[fd=%d]: read header: got %d / %Zd bytes\n",
-               fd, done, sizeof head);
+    log_warn_F("[fd=%d]: read header: got %d / %d bytes\n",
+               fd, done, have);
     return 0;                   // EOF
   }
-  if (head.sync != BMEIPC_SYNCWORD)
+  memcpy(&head, buf, sizeof head);
+
+  bmeipc_parser_init(&parser, INT32_MAX);
+  while ((rc = bmeipc_parse(&parser, buf, have, &used, &ev)) ==
+         BMEIPC_PARSE_MORE)
   {
-    log_warn_F("[fd=%d]: read header: %s\n", fd, "out of sync");
-    return 0;                   // EOF
+    // v2 header, read the extra fields
+    have = BMEIPC_HEADER_MAX - sizeof head;
+
+    if ((done = bme_bytes_read(fd, buf, have)) != have)
+    {
+      log_warn_F("[fd=%d]: read header: got %d / %d extra bytes\n",
+                 fd, done, have);
+      return done == -1 ? -1 : 0;
+    }
   }
-  if (head.size < 0)
+  if (rc == BMEIPC_PARSE_ERROR)
   {
-    log_warn_F("[fd=%d]: read header: %s\n", fd, "negative size");
+    log_warn_F("[fd=%d]: read header: %s\n", fd,
+               head.sync == BMEIPC_SYNCWORD || head.sync == BMEIPC_SYNCWORD_V2 ?
+               "negative size" : "out of sync");
+    BME_PROBE3(sync_error, fd, head.sync, head.size);
     return 0;                   // EOF
   }
 
-  return head.size;
+  if (frame)
+  {
+    *frame = ev.frame;
+  }
+  return ev.size;
+}
+
+static int
+bme_header_read(int fd, bmeipc_frame_t *frame)
+{
+  int rc;
+
+  BME_PROBE1(header_read_entry, fd);
+  rc = header_read(fd, frame);
+  BME_PROBE2(header_read_return, fd, rc);
+  return rc;
+}
+
+/**
+ * Throw away the payload of a packet that did not fit
+ *
+ * @fd: socket descriptor
+ * @bytes: payload size
+ *
+ * @return 0 on success, -1 on error
+ */
+static int
+packet_skip(int fd, int bytes)
+{
+  char buf[256];
+
+  while (bytes > 0)
+  {
+    int n = bytes < (int)sizeof buf ? bytes : (int)sizeof buf;
+
+    if (bme_bytes_read(fd, buf, n) != n)
+    {
+      return -1;
+    }
+    bytes -= n;
+  }
+  return 0;
+}
+
+/**
+ * Shut down a connection whose stream can no longer be followed
+ *
+ * Later reads see EOF and writes fail, instead of parsing payload
+ * bytes as headers. The descriptor stays open for its owner to close.
+ *
+ * @fd: socket descriptor
+ */
+static void
+packet_poison(int fd)
+{
+  log_warn_F("[fd=%d]: stream out of sync, shutting down\n", fd);
+  shutdown(fd, SHUT_RDWR);
 }
 
 /**
  * Read packet from socket
  *
  * @fd: socket descriptor
+ * @frame: v2 header fields of the packet, or NULL
  * @msg: buffer address
  * @bytes: buffer size
  *
  * @return number of bytes read, -1=ERR, 0=EOF/out-of-sync
  */
-int
-bme_packet_read(int fd, void *msg, int bytes)
+static int
+packet_read(int fd, bmeipc_frame_t *frame, void *msg, int bytes)
 {
   int ret;
 
-  if ((ret = bme_header_read(fd)) <= 0)
+  if ((ret = bme_header_read(fd, frame)) <= 0)
   {
     return ret;                 // ERR or EOF
   }
@@ -310,6 +578,11 @@ bme_packet_read(int fd, void *msg, int bytes)
   {
     log_warn_F("[fd=%d]: read packet: got %d, expected max %d bytes\n",
                fd, ret, bytes);
+    // keep the stream in sync for the next packet, if that is sane
+    if (ret > BMEIPC_PAYLOAD_MAX || packet_skip(fd, ret) == -1)
+    {
+      packet_poison(fd);
+    }
     // set errno to something meaningful
     errno = EBADMSG;
     return -1;
@@ -330,46 +603,265 @@ bme_packet_read(int fd, void *msg, int bytes)
     return -1;
   }
 
+  _bme_capture(fd, BMECAP_READ, msg, ret);
+  return ret;
+}
+
+/**
+ * Read packet from socket
+ *
+ * Accepts both v1 and v2 framed packets; v2 header fields are dropped.
+ *
+ * @fd: socket descriptor
+ * @msg: buffer address
+ * @bytes: buffer size
+ *
+ * @return number of bytes read, -1=ERR, 0=EOF/out-of-sync
+ */
+int
+bme_packet_read(int fd, void *msg, int bytes)
+{
+  return packet_read(fd, 0, msg, bytes);
+}
+
+/**
+ * Read packet and its header fields from socket
+ *
+ * @fd: socket descriptor
+ * @frame: header fields of the packet
+ * @msg: buffer address
+ * @bytes: buffer size
+ *
+ * @return number of bytes read, -1=ERR, 0=EOF/out-of-sync
+ */
+int
+bme_frame_read(int fd, bmeipc_frame_t *frame, void *msg, int bytes)
+{
+  return packet_read(fd, frame, msg, bytes);
+}
+
+/**
+ * Read packet into an arena, sized by its header
+ *
+ * @fd: socket descriptor
+ * @arena: arena to place the packet in
+ * @msg: packet data in the arena
+ *
+ * @return number of bytes read, -1=ERR, 0=EOF/out-of-sync
+ */
+int
+bme_packet_read_arena(int fd, bme_arena_t *arena, void **msg)
+{
+  int ret, done;
+
+  *msg = 0;
+  if ((ret = bme_header_read(fd, 0)) <= 0)
+  {
+    return ret;                 // ERR or EOF
+  }
+  if (ret > BMEIPC_PAYLOAD_MAX)
+  {
+    log_warn_F("[fd=%d]: read packet: got %d, expected max %d bytes\n",
+               fd, ret, BMEIPC_PAYLOAD_MAX);
+    packet_poison(fd);
+    errno = EMSGSIZE;
+    return -1;
+  }
+  if ((*msg = bme_arena_alloc(arena, ret)) == 0)
+  {
+    if (packet_skip(fd, ret) == -1)
+    {
+      packet_poison(fd);
+    }
+    errno = ENOMEM;
+    return -1;
+  }
+  if ((done = bme_bytes_read(fd, *msg, ret)) != ret)
+  {
+    log_warn_F("[fd=%d]: read packet: got %d/%d bytes\n", fd, done, ret);
+
+    if (done != -1)
+    {
+      // set errno to something meaningful
+      errno = EBADMSG;
+    }
+    *msg = 0;
+    return -1;
+  }
+
+  _bme_capture(fd, BMECAP_READ, *msg, ret);
+  return ret;
+}
+
+/**
+ * Write a packet with v2 header fields to the socket.
+ *
+ * @fd: socket descriptor
+ * @frame: header fields, a v1 header is written if version is below 2
+ * @msg: data address
+ * @bytes: size of data to write
+ *
+ * @return number of bytes written, -1=Error
+ */
+int
+bme_frame_write(int fd, const bmeipc_frame_t *frame, const void *msg,
+                int bytes)
+{
+  bmeipc_header_v2 hdr;
+  struct iovec iov[2];
+  int tot = sizeof hdr + bytes;
+  int ret;
+
+  if (frame == 0 || frame->version < 2)
+  {
+    return bme_packet_write(fd, msg, bytes);
+  }
+
+  hdr.base.sync = BMEIPC_SYNCWORD_V2;
+  hdr.base.size = bytes;
+  hdr.reqid = frame->reqid;
+  hdr.type = frame->type;
+  hdr.flags = frame->flags;
+
+  iov[0].iov_base = &hdr;
+  iov[0].iov_len = sizeof hdr;
+  iov[1].iov_base = (void *)msg;
+  iov[1].iov_len = bytes;
+
+  BME_PROBE3(packet_write_entry, fd, frame->type, bytes);
+  ret = writev(fd, iov, 2);
+
+  if (ret == -1)
+  {
+    log_warn_F("[fd=%d]: write ERROR: %s\n", fd, strerror(errno));
+  }
+  else if (ret != tot)
+  {
+    log_warn_F("[fd=%d]: write ERROR: %d/%d bytes\n", fd, ret, tot);
+    // set errno to something meaningful
+    errno = ECOMM;
+    ret = -1;
+  }
+  else
+  {
+    ret = bytes;
+    _bme_capture(fd, BMECAP_WRITE, msg, bytes);
+  }
+
+  BME_PROBE3(packet_write_return, fd, frame->type, ret);
   return ret;
 }
 
+/**
+ * Answer a request in the framing the request came in.
+ *
+ * v1: status packet, then data packet if status >= 0 and there is data.
+ * v2: one BMEIPC_F_REPLY frame carrying status followed by data.
+ *
+ * @fd: socket descriptor
+ * @req: header fields of the request being answered
+ * @status: status word
+ * @data: reply data, or NULL
+ * @bytes: size of reply data
+ *
+ * @return 0=Success, -1=Error
+ */
+int
+bme_reply_write(int fd, const bmeipc_frame_t *req, int status,
+                const void *data, int bytes)
+{
+  if (status < 0 || data == 0)
+  {
+    bytes = 0;
+  }
+
+  if (req && req->version >= 2)
+  {
+    bmeipc_frame_t rep = {
+      .version = 2,
+      .reqid = req->reqid,
+      .type = req->type,
+      .flags = BMEIPC_F_REPLY,
+    };
+    int tot = sizeof status + bytes;
+    char buf[512];
+    char *p = tot <= (int)sizeof buf ? buf : malloc(tot);
+    int ret;
+
+    if (p == 0)
+    {
+      return -1;
+    }
+    memcpy(p, &status, sizeof status);
+    if (bytes)
+    {
+      memcpy(p + sizeof status, data, bytes);
+    }
+    ret = bme_frame_write(fd, &rep, p, tot);
+    if (p != buf)
+    {
+      free(p);
+    }
+    return ret == tot ? 0 : -1;
+  }
+
+  if (bme_packet_write(fd, &status, sizeof status) != sizeof status)
+  {
+    return -1;
+  }
+  if (bytes && bme_packet_write(fd, data, bytes) != bytes)
+  {
+    return -1;
+  }
+  return 0;
+}
+
 /**
  * Handle cookie handshake from accepting end (server/bme)
+ *
+ * The ack byte advertises the highest framing version the server
+ * speaks. v1 clients ignore its content; v2 clients switch to v2
+ * headers when they see BMEIPC_ACK_V2.
  * 
  * @fd: socket descriptor
  * @cookie: string that is expected
+ * @maxver: highest framing version to advertise, 1 or 2
  * 
  * @return status value 0=Success, -1=Error
  */
 int
-_bme_cookie_read(int fd, const char *cookie)
+_bme_cookie_read_ver(int fd, const char *cookie, int maxver)
 {
   int error = -1;
   int todo = strlen(cookie);
-  char *magic = alloca(todo);
+  char magic[BMEIPC_COOKIE_MAX];
+  const char *ack = maxver >= 2 ? BMEIPC_ACK_V2 : BMEIPC_ACK_V1;
   int done = 0;
 
-  // read cookie string
-  done = bme_packet_read(fd, magic, todo);
-  if (done == -1)
+  if (todo > (int)sizeof magic)
   {
-    log_warn_F("read cookie: %s\n", strerror(errno));
+    log_warn_F("read cookie: %d bytes expected, at most %d supported\n",
+               todo, (int)sizeof magic);
+    errno = EINVAL;
     goto cleanup;
   }
-  if (done != todo)
+
+  // read cookie string
+  done = bme_packet_read(fd, magic, sizeof magic);
+  if (done == -1)
   {
-    log_warn_F("read cookie: got %d of %d bytes", done, todo);
+    log_warn_F("read cookie: %s\n", strerror(errno));
     goto cleanup;
   }
-  if (strncmp(magic, cookie, todo))
+  if (bmeipc_cookie_check(magic, done, cookie) == -1)
   {
-    log_warn_F("cookie mismatch: got %*s, expected %s\n", done, magic,
+    log_warn_F("cookie mismatch: got %.*s, expected %s\n", done, magic,
                cookie);
     goto cleanup;
   }
 
   // write ack byte
-  done = bme_packet_write(fd, "\n", 1);
+  done = bme_packet_write(fd, ack, 1);
   if (done == -1)
   {
     log_warn_F("write ack: %s", strerror(errno));
@@ -387,21 +879,28 @@ cleanup:
   return error;
 }
 
+int
+_bme_cookie_read(int fd, const char *cookie)
+{
+  return _bme_cookie_read_ver(fd, cookie, 1);
+}
+
 /**
  * Handle cookie handshake from connecting end (client/app)
  * 
  * @fd: socket descriptor
  * @cookie: string that is to be sent
+ * @version: framing version advertised by the server, or NULL
  * 
  * @return status value 0=Success, -1=Error
  */
-
 int
-_bme_cookie_write(int fd, const char *cookie)
+_bme_cookie_write_ver(int fd, const char *cookie, int *version)
 {
   int error = -1;
   int todo = strlen(cookie);
   int done = 0;
+  int ver;
   char ack = 0;
 
   // write cookie string
@@ -424,18 +923,28 @@ _bme_cookie_write(int fd, const char *cookie)
     log_warn_F("read ack: %s\n", strerror(errno));
     goto cleanup;
   }
-  if (done != 1)
+  if ((ver = bmeipc_ack_version(&ack, done)) == -1)
   {
     log_warn_F("read ack: got %d of %d bytes\n", done, 1);
     goto cleanup;
   }
 
+  if (version)
+  {
+    *version = ver;
+  }
   error = 0;
 
 cleanup:
   return error;
 }
 
+int
+_bme_cookie_write(int fd, const char *cookie)
+{
+  return _bme_cookie_write_ver(fd, cookie, 0);
+}
+
 /**
  * Connect to BME server.
  *
@@ -444,7 +953,19 @@ cleanup:
 int
 bmeipc_open(void)
 {
-  static const char path[] = BME_SRV_SOCK_PATH;
+  return bmeipc_open_path(BME_SRV_SOCK_PATH);
+}
+
+/**
+ * Connect to BME compatible server listening on given socket path.
+ *
+ * @path: unix socket path
+ *
+ * @return socket descriptor if successful, -1=Error
+ */
+int
+bmeipc_open_path(const char *path)
+{
   static const char cookie[] = BME_SRV_COOKIE;
 
   int result = -1;              // assume failure
@@ -505,22 +1026,93 @@ int
 bme_send_get_reply(int32_t sd, const void *smsg, int sbytes,
                    void *rmsg, int rbytes, int *rbytes_act)
 {
-  int status, nb;
+  int status = -1, nb = 0;
+
+  BME_PROBE4(send_get_reply_entry, sd,
+             BME_PROBE_TYPE(send_get_reply_entry, smsg, sbytes),
+             sbytes, rbytes);
 
   if (bme_write(sd, smsg, sbytes) != sbytes)
-    return -1;
+    goto cleanup;
 
   if (bme_read(sd, &status, sizeof(status)) == -1)
-    return -1;
+  {
+    status = -1;
+    goto cleanup;
+  }
 
   if (status >= 0 && rmsg && rbytes)
   {
     nb = bme_read(sd, rmsg, rbytes);
     if (nb == -1)
-      return -1;
+    {
+      status = -1;
+      goto cleanup;
+    }
     if (rbytes_act)
       *rbytes_act = nb;
   }
+
+cleanup:
+  BME_PROBE4(send_get_reply_return, sd,
+             BME_PROBE_TYPE(send_get_reply_return, smsg, sbytes),
+             status, nb);
+  return status;
+}
+
+/**
+ * Send message to the server and read the reply into an arena
+ *
+ * @sd: fd to bme
+ * @smsg: message address
+ * @sbytes: message size
+ * @arena: per-connection arena, reset here
+ * @rmsg: reply data in the arena; NULL if no reply data is expected
+ * @rbytes: size of reply data, or NULL
+ *
+ * @return server status, -1=Error
+ */
+int
+bme_send_get_reply_arena(int32_t sd, const void *smsg, int sbytes,
+                         bme_arena_t *arena, void **rmsg, int *rbytes)
+{
+  int status = -1, nb = 0;
+
+  BME_PROBE4(send_get_reply_entry, sd,
+             BME_PROBE_TYPE(send_get_reply_entry, smsg, sbytes),
+             sbytes, 0);
+
+  bme_arena_reset(arena);
+  if (rmsg)
+    *rmsg = 0;
+  if (rbytes)
+    *rbytes = 0;
+
+  if (bme_write(sd, smsg, sbytes) != sbytes)
+    goto cleanup;
+
+  if (bme_read(sd, &status, sizeof(status)) == -1)
+  {
+    status = -1;
+    goto cleanup;
+  }
+
+  if (status >= 0 && rmsg)
+  {
+    nb = bme_packet_read_arena(sd, arena, rmsg);
+    if (nb == -1)
+    {
+      status = -1;
+      goto cleanup;
+    }
+    if (rbytes)
+      *rbytes = nb;
+  }
+
+cleanup:
+  BME_PROBE4(send_get_reply_return, sd,
+             BME_PROBE_TYPE(send_get_reply_return, smsg, sbytes),
+             status, nb);
   return status;
 }
 
@@ -578,6 +1170,7 @@ bmeipc_close(int32_t sd)
 {
   if (sd != -1)
   {
+    bmeipc_set_read_spin(sd, 0);
     if (TEMP_FAILURE_RETRY(close(sd)) == -1)
     {
       log_warn_F("close: %s\n", strerror(errno));
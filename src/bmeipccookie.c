@@ -36,3 +36,13 @@ int bme_cookie_write(int fd, const char *cookie)
 {
   return _bme_cookie_write(fd, cookie);
 }
+
+int bme_cookie_read_ver(int fd, const char *cookie, int maxver)
+{
+  return _bme_cookie_read_ver(fd, cookie, maxver);
+}
+
+int bme_cookie_write_ver(int fd, const char *cookie, int *version)
+{
+  return _bme_cookie_write_ver(fd, cookie, version);
+}
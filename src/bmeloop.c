@@ -0,0 +1,264 @@
+/**
+   @file bmeloop.c
+
+   @brief Minimal epoll event loop for asynchronous BME IPC
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+
+#include "bmeipc-internal.h"
+#include "bmeloop.h"
+
+/* Events fetched per epoll_wait() */
+#define LOOP_BATCH 64
+
+typedef struct watch_s
+{
+  struct watch_s *next;         // on the dead list
+  int fd;
+  int dead;                     // removed, free after dispatch
+  bme_loop_cb cb;
+  void *data;
+} watch_t;
+
+struct bme_loop_s
+{
+  int epfd;
+  int quit;
+  int dispatching;
+  watch_t **byfd;               // live watches indexed by descriptor
+  size_t nbyfd;
+  watch_t *dead;
+};
+
+static watch_t *
+watch_find(bme_loop_t *loop, int fd)
+{
+  return fd >= 0 && (size_t)fd < loop->nbyfd ? loop->byfd[fd] : 0;
+}
+
+/**
+ * Free watches removed while dispatching
+ */
+static void
+watch_reap(bme_loop_t *loop)
+{
+  watch_t *w;
+
+  while ((w = loop->dead) != 0)
+  {
+    loop->dead = w->next;
+    free(w);
+  }
+}
+
+bme_loop_t *
+bme_loop_new(void)
+{
+  bme_loop_t *loop = calloc(1, sizeof *loop);
+
+  if (loop == 0)
+  {
+    return 0;
+  }
+  if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+  {
+    log_error_F("epoll_create1: %s\n", strerror(errno));
+    free(loop);
+    return 0;
+  }
+  return loop;
+}
+
+void
+bme_loop_free(bme_loop_t *loop)
+{
+  size_t i;
+
+  if (loop == 0)
+  {
+    return;
+  }
+  for (i = 0; i < loop->nbyfd; i++)
+  {
+    free(loop->byfd[i]);
+  }
+  watch_reap(loop);
+  free(loop->byfd);
+  close(loop->epfd);
+  free(loop);
+}
+
+int32_t
+bme_loop_fd(const bme_loop_t *loop)
+{
+  return loop->epfd;
+}
+
+int32_t
+bme_loop_add(bme_loop_t *loop, int32_t fd, uint32_t events,
+             bme_loop_cb cb, void *data)
+{
+  struct epoll_event ev;
+  watch_t *w;
+
+  if (fd < 0)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  if (watch_find(loop, fd))
+  {
+    errno = EEXIST;
+    return -1;
+  }
+  if ((size_t)fd >= loop->nbyfd)
+  {
+    size_t n = loop->nbyfd ? loop->nbyfd : 64;
+    watch_t **p;
+
+    while (n <= (size_t)fd)
+    {
+      n *= 2;
+    }
+    if ((p = realloc(loop->byfd, n * sizeof *p)) == 0)
+    {
+      return -1;
+    }
+    memset(p + loop->nbyfd, 0, (n - loop->nbyfd) * sizeof *p);
+    loop->byfd = p;
+    loop->nbyfd = n;
+  }
+  if ((w = calloc(1, sizeof *w)) == 0)
+  {
+    return -1;
+  }
+  w->fd = fd;
+  w->cb = cb;
+  w->data = data;
+
+  memset(&ev, 0, sizeof ev);
+  ev.events = events;
+  ev.data.ptr = w;
+  if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+  {
+    log_warn_F("[fd=%d] epoll add: %s\n", fd, strerror(errno));
+    free(w);
+    return -1;
+  }
+
+  loop->byfd[fd] = w;
+  return 0;
+}
+
+int32_t
+bme_loop_mod(bme_loop_t *loop, int32_t fd, uint32_t events)
+{
+  struct epoll_event ev;
+  watch_t *w = watch_find(loop, fd);
+
+  if (w == 0)
+  {
+    errno = ENOENT;
+    return -1;
+  }
+  memset(&ev, 0, sizeof ev);
+  ev.events = events;
+  ev.data.ptr = w;
+  return epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+int32_t
+bme_loop_del(bme_loop_t *loop, int32_t fd)
+{
+  watch_t *w = watch_find(loop, fd);
+
+  if (w == 0)
+  {
+    errno = ENOENT;
+    return -1;
+  }
+  epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, 0);
+  loop->byfd[fd] = 0;
+  w->dead = 1;
+  w->next = loop->dead;
+  loop->dead = w;
+  if (!loop->dispatching)
+  {
+    watch_reap(loop);
+  }
+  return 0;
+}
+
+int32_t
+bme_loop_iterate(bme_loop_t *loop, int32_t timeout_ms)
+{
+  struct epoll_event ev[LOOP_BATCH];
+  int n, i;
+
+  n = epoll_wait(loop->epfd, ev, LOOP_BATCH, timeout_ms);
+  if (n == -1)
+  {
+    if (errno == EINTR)
+    {
+      return 0;
+    }
+    log_warn_F("epoll_wait: %s\n", strerror(errno));
+    return -1;
+  }
+
+  loop->dispatching++;
+  for (i = 0; i < n; i++)
+  {
+    watch_t *w = ev[i].data.ptr;
+    if (!w->dead)
+    {
+      w->cb(loop, w->fd, ev[i].events, w->data);
+    }
+  }
+  if (--loop->dispatching == 0)
+  {
+    watch_reap(loop);
+  }
+  return n;
+}
+
+int32_t
+bme_loop_run(bme_loop_t *loop)
+{
+  loop->quit = 0;
+  while (!loop->quit)
+  {
+    if (bme_loop_iterate(loop, -1) == -1)
+    {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void
+bme_loop_quit(bme_loop_t *loop)
+{
+  loop->quit = 1;
+}
@@ -0,0 +1,411 @@
+/**
+   @file bmemulti.c
+
+   @brief Concurrent queries to several BME servers
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "bmeipc.h"
+#include "bmeipc-internal.h"
+#include "bmemsg.h"
+#include "bmeloop.h"
+#include "bmeasync.h"
+#include "bmemulti.h"
+
+typedef struct
+{
+  bme_multi_t *query;
+  int32_t index;
+  bme_aconn_t *conn;
+  uint32_t todo;                // BME_MULTI_* bits not reported yet
+  int error;                    // failed before any request was sent
+  int timed;                    // has a deadline
+  struct timespec deadline;
+} endpoint_t;
+
+struct bme_multi_s
+{
+  bme_loop_t *loop;
+  int tfd;                      // timerfd armed for the nearest deadline
+  endpoint_t *ep;
+  int32_t count;
+  int32_t pending;
+  bme_multi_cb cb;
+  void *user;
+  int busy;                     // inside a callback
+  int freeing;                  // free requested while busy
+};
+
+static void
+multi_destroy(bme_multi_t *q)
+{
+  int32_t i;
+
+  for (i = 0; i < q->count; i++)
+  {
+    bme_aconn_close(q->ep[i].conn);
+  }
+  if (q->tfd != -1)
+  {
+    bme_loop_del(q->loop, q->tfd);
+    close(q->tfd);
+  }
+  free(q->ep);
+  free(q);
+}
+
+/**
+ * Leave a callback; the query may be gone afterwards
+ */
+static void
+multi_unbusy(bme_multi_t *q)
+{
+  if (--q->busy == 0 && q->freeing)
+  {
+    multi_destroy(q);
+  }
+}
+
+/**
+ * Hand one result to the user
+ */
+static void
+multi_report(endpoint_t *ep, uint32_t what, int32_t status, int error,
+             const void *data)
+{
+  bme_multi_t *q = ep->query;
+  bme_multi_result_t res = {
+    .endpoint = ep->index,
+    .what = what,
+    .status = status,
+    .error = status < 0 ? error : 0,
+  };
+
+  if (q->freeing || !(ep->todo & what))
+  {
+    return;
+  }
+  if (data && what == BME_MULTI_STAT)
+  {
+    res.stat = data;
+  }
+  if (data && what == BME_MULTI_BATTERY_INFO)
+  {
+    res.info = data;
+  }
+
+  ep->todo &= ~what;
+  q->pending--;
+  if (ep->todo == 0)
+  {
+    bme_aconn_close(ep->conn);
+    ep->conn = 0;
+  }
+  q->cb(q, &res, q->user);
+}
+
+/**
+ * Report everything still outstanding on an endpoint as failed
+ */
+static void
+multi_fail(endpoint_t *ep, int error)
+{
+  bme_aconn_close(ep->conn);
+  ep->conn = 0;
+  multi_report(ep, BME_MULTI_STAT, -1, error, 0);
+  multi_report(ep, BME_MULTI_BATTERY_INFO, -1, error, 0);
+}
+
+static int
+ts_before(const struct timespec *a, const struct timespec *b)
+{
+  return a->tv_sec < b->tv_sec ||
+    (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/**
+ * Arm the timer for the nearest deadline of an unfinished endpoint
+ */
+static void
+multi_arm(bme_multi_t *q)
+{
+  struct itimerspec its;
+  int armed = 0;
+  int32_t i;
+
+  memset(&its, 0, sizeof its);
+  for (i = 0; i < q->count; i++)
+  {
+    const endpoint_t *ep = &q->ep[i];
+
+    if (ep->todo && ep->timed &&
+        (!armed || ts_before(&ep->deadline, &its.it_value)))
+    {
+      its.it_value = ep->deadline;
+      armed = 1;
+    }
+  }
+  timerfd_settime(q->tfd, TFD_TIMER_ABSTIME, &its, 0);
+}
+
+static void
+multi_timer(bme_loop_t *loop, int32_t fd, uint32_t events, void *data)
+{
+  bme_multi_t *q = data;
+  struct timespec now;
+  uint64_t ticks;
+  int32_t i;
+
+  (void)loop;
+  (void)events;
+
+  if (read(fd, &ticks, sizeof ticks) == -1 && errno == EAGAIN)
+  {
+    return;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  q->busy++;
+  for (i = 0; i < q->count && !q->freeing; i++)
+  {
+    endpoint_t *ep = &q->ep[i];
+
+    if (ep->todo && ep->timed &&
+        (ep->error || !ts_before(&now, &ep->deadline)))
+    {
+      multi_fail(ep, ep->error ? ep->error : ETIMEDOUT);
+    }
+  }
+  if (!q->freeing)
+  {
+    multi_arm(q);
+  }
+  multi_unbusy(q);
+}
+
+static void
+multi_reply(bme_aconn_t *conn, uint32_t what, int32_t status,
+            const void *data, int32_t bytes, int32_t want, void *user)
+{
+  endpoint_t *ep = user;
+  bme_multi_t *q = ep->query;
+  int error = errno;
+  union
+  {
+    bmestat_t stat;
+    struct emsg_battery_info_reply info;
+  } reply;
+
+  (void)conn;
+
+  if (status >= 0 && bytes != want)
+  {
+    log_warn_F("bme_multi: reply of %d bytes, wanted %d\n", bytes, want);
+    status = -1;
+    error = EBADMSG;
+  }
+  if (status >= 0)
+  {
+    /* Packets are not aligned in the receive buffer */
+    memcpy(&reply, data, want);
+  }
+
+  q->busy++;
+  multi_report(ep, what, status, error, status < 0 ? 0 : &reply);
+  multi_unbusy(q);
+}
+
+static void
+multi_stat_reply(bme_aconn_t *conn, int32_t status, const void *data,
+                 int32_t bytes, void *user)
+{
+  multi_reply(conn, BME_MULTI_STAT, status, data, bytes,
+              sizeof(bmestat_t), user);
+}
+
+static void
+multi_info_reply(bme_aconn_t *conn, int32_t status, const void *data,
+                 int32_t bytes, void *user)
+{
+  multi_reply(conn, BME_MULTI_BATTERY_INFO, status, data, bytes,
+              sizeof(struct emsg_battery_info_reply), user);
+}
+
+/**
+ * Connect to an endpoint and queue its requests
+ *
+ * @return 0 on success, errno value to report otherwise
+ */
+static int
+multi_send(endpoint_t *ep, const char *path, uint32_t info_flags)
+{
+  bme_multi_t *q = ep->query;
+  bmeipc_msg_t stat = {.type = BME_SYSMSG_PROXY_GETTIME,.subtype = 0 };
+  struct emsg_battery_info_req info = {
+    .type = BME_BATTERY_INFO_REQ,.subtype = 0,.flags = info_flags
+  };
+
+  if ((ep->conn = bme_aconn_connect(q->loop, path, 0)) == 0)
+  {
+    return errno;
+  }
+  if ((ep->todo & BME_MULTI_STAT) &&
+      bme_aconn_request(ep->conn, &stat, sizeof stat, 1,
+                        multi_stat_reply, ep) == -1)
+  {
+    return errno;
+  }
+  if ((ep->todo & BME_MULTI_BATTERY_INFO) &&
+      bme_aconn_request(ep->conn, &info, sizeof info, 1,
+                        multi_info_reply, ep) == -1)
+  {
+    return errno;
+  }
+  return 0;
+}
+
+bme_multi_t *
+bme_multi_start(bme_loop_t *loop, const bme_endpoint_t *ep, int32_t count,
+                uint32_t what, uint32_t info_flags, bme_multi_cb cb,
+                void *user)
+{
+  struct timespec now;
+  bme_multi_t *q;
+  int32_t i;
+
+  what &= BME_MULTI_STAT | BME_MULTI_BATTERY_INFO;
+  if (count < 0 || what == 0 || cb == 0)
+  {
+    errno = EINVAL;
+    return 0;
+  }
+  if ((q = calloc(1, sizeof *q)) == 0)
+  {
+    return 0;
+  }
+  q->loop = loop;
+  q->cb = cb;
+  q->user = user;
+  q->count = count;
+  q->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (q->tfd == -1 || (q->ep = calloc(count + 1, sizeof *q->ep)) == 0 ||
+      bme_loop_add(loop, q->tfd, EPOLLIN, multi_timer, q) == -1)
+  {
+    log_error_F("bme_multi_start: %s\n", strerror(errno));
+    if (q->tfd != -1)
+    {
+      close(q->tfd);
+    }
+    free(q->ep);
+    free(q);
+    return 0;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  for (i = 0; i < count; i++)
+  {
+    endpoint_t *e = &q->ep[i];
+    int32_t ms = ep[i].timeout_ms;
+
+    e->query = q;
+    e->index = i;
+    e->todo = what;
+    if ((e->timed = ms > 0))
+    {
+      e->deadline.tv_sec = now.tv_sec + ms / 1000;
+      e->deadline.tv_nsec = now.tv_nsec + (ms % 1000) * 1000000L;
+      if (e->deadline.tv_nsec >= 1000000000L)
+      {
+        e->deadline.tv_sec++;
+        e->deadline.tv_nsec -= 1000000000L;
+      }
+    }
+    q->pending += __builtin_popcount(what);
+
+    /* Failures to connect are reported from the loop like the rest */
+    if ((e->error = multi_send(e, ep[i].path, info_flags)) != 0)
+    {
+      bme_aconn_close(e->conn);
+      e->conn = 0;
+      e->timed = 1;
+      e->deadline = now;
+    }
+  }
+  multi_arm(q);
+  return q;
+}
+
+int32_t
+bme_multi_pending(const bme_multi_t *query)
+{
+  return query->pending;
+}
+
+void
+bme_multi_free(bme_multi_t *query)
+{
+  if (query == 0)
+  {
+    return;
+  }
+  if (query->busy)
+  {
+    query->freeing = 1;
+    return;
+  }
+  multi_destroy(query);
+}
+
+int32_t
+bme_multi_run(const bme_endpoint_t *ep, int32_t count, uint32_t what,
+              uint32_t info_flags, bme_multi_cb cb, void *user)
+{
+  int32_t result = -1;
+  bme_loop_t *loop;
+  bme_multi_t *q = 0;
+
+  if ((loop = bme_loop_new()) == 0)
+  {
+    goto cleanup;
+  }
+  if ((q = bme_multi_start(loop, ep, count, what, info_flags, cb, user)) == 0)
+  {
+    goto cleanup;
+  }
+  while (bme_multi_pending(q) > 0)
+  {
+    if (bme_loop_iterate(loop, -1) == -1)
+    {
+      goto cleanup;
+    }
+  }
+  result = 0;
+
+cleanup:
+  bme_multi_free(q);
+  bme_loop_free(loop);
+  return result;
+}
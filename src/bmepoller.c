@@ -0,0 +1,450 @@
+/**
+   @file bmepoller.c
+
+   @brief Shared periodic polling of BME statistics
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "bmeipc.h"
+#include "bmeipc-internal.h"
+#include "bmestat.h"
+#include "bmeloop.h"
+#include "bmeasync.h"
+#include "bmepoller.h"
+
+struct bme_poll_sub_s
+{
+  bme_poll_sub_t *next;
+  bme_poller_t *poller;
+  int64_t due;                  // start of the window to be served in, ms
+  int32_t period;
+  int32_t slack;
+  uint32_t changed;             // slots changed since the last call
+  int waiting;                  // to be served by the request in flight
+  int removed;
+  bme_poll_cb cb;
+  void *user;
+};
+
+struct bme_poller_s
+{
+  bme_loop_t *loop;
+  char *path;
+  int tfd;
+  bme_aconn_t *conn;
+  int in_flight;
+  int64_t deadline;             // in-flight request fails at this time
+  bmestat_t last;
+  int have_last;
+  uint32_t requests;
+  bme_poll_sub_t *subs;
+  int busy;                     // inside a callback
+  int freeing;                  // free requested while busy
+  int reap;                     // removed subscriptions to free
+};
+
+static int64_t
+now_ms(void)
+{
+  struct timeval tv;
+
+  _bme_getmonotime(&tv);
+  return (int64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static void
+poller_destroy(bme_poller_t *p)
+{
+  bme_poll_sub_t *s;
+
+  while ((s = p->subs) != 0)
+  {
+    p->subs = s->next;
+    free(s);
+  }
+  bme_aconn_close(p->conn);
+  bme_loop_del(p->loop, p->tfd);
+  close(p->tfd);
+  free(p->path);
+  free(p);
+}
+
+/**
+ * Schedule the next tick
+ *
+ * The tick is due when the first subscriber runs out of slack, or at
+ * the grid point before that if its window is already open by then.
+ * Subscribers waiting for the request in flight are served by its
+ * reply, or failed at its deadline.
+ */
+static void
+poller_arm(bme_poller_t *p)
+{
+  struct itimerspec its;
+  const bme_poll_sub_t *s;
+  int64_t at = INT64_MAX, open = 0;
+
+  memset(&its, 0, sizeof its);
+  for (s = p->subs; s; s = s->next)
+  {
+    if (!s->removed && !s->waiting && s->due + s->slack < at)
+    {
+      at = s->due + s->slack;
+      open = s->due;
+    }
+  }
+
+  if (at != INT64_MAX && at - at % BME_POLLER_GRID_MS >= open)
+  {
+    at -= at % BME_POLLER_GRID_MS;
+  }
+  if (p->in_flight && p->deadline < at)
+  {
+    at = p->deadline;
+  }
+
+  if (at != INT64_MAX)
+  {
+    if (at <= 0)
+    {
+      at = 1;                   // zero would disarm
+    }
+    its.it_value.tv_sec = at / 1000;
+    its.it_value.tv_nsec = (at % 1000) * 1000000L;
+  }
+  timerfd_settime(p->tfd, TFD_TIMER_ABSTIME, &its, 0);
+}
+
+/**
+ * Leave a callback; the poller may be gone afterwards
+ */
+static void
+poller_unbusy(bme_poller_t *p)
+{
+  bme_poll_sub_t **ps;
+
+  if (--p->busy > 0)
+  {
+    return;
+  }
+  if (p->freeing)
+  {
+    poller_destroy(p);
+    return;
+  }
+  if (p->reap)
+  {
+    p->reap = 0;
+    ps = &p->subs;
+    while (*ps)
+    {
+      bme_poll_sub_t *s = *ps;
+      if (s->removed)
+      {
+        *ps = s->next;
+        free(s);
+      }
+      else
+      {
+        ps = &s->next;
+      }
+    }
+  }
+  poller_arm(p);
+}
+
+/**
+ * Serve the waiting subscribers
+ */
+static void
+poller_deliver(bme_poller_t *p, const bmestat_t *stat, uint32_t mask,
+               int error)
+{
+  int64_t now = now_ms();
+  bme_poll_sub_t *s;
+
+  p->busy++;
+  for (s = p->subs; s && !p->freeing; s = s->next)
+  {
+    uint32_t changed;
+
+    if (s->removed)
+    {
+      continue;
+    }
+    if (stat)
+    {
+      s->changed |= mask;
+    }
+    if (!s->waiting)
+    {
+      continue;
+    }
+    s->waiting = 0;
+    s->due = now + s->period;
+
+    changed = s->changed;
+    if (stat)
+    {
+      s->changed = 0;
+    }
+    errno = error;
+    s->cb(s, stat, stat ? changed : 0, s->user);
+  }
+  poller_unbusy(p);
+}
+
+static void
+poller_reply(bme_aconn_t *conn, int32_t status, const void *data,
+             int32_t bytes, void *user)
+{
+  bme_poller_t *p = user;
+  int error = errno;
+  bmestat_t stat;
+  uint32_t mask;
+
+  p->in_flight = 0;
+
+  if (status < 0 || bytes != sizeof stat)
+  {
+    if (status >= 0)
+    {
+      error = EBADMSG;
+    }
+    if (error)
+    {
+      /* Broken connection; reconnect on the next tick */
+      bme_aconn_close(conn);
+      p->conn = 0;
+    }
+    poller_deliver(p, 0, 0, error ? error : EIO);
+    return;
+  }
+
+  memcpy(stat, data, sizeof stat);
+  mask = p->have_last ? bmestat_diff(&p->last, &stat, 0) : ~0u;
+  memcpy(p->last, stat, sizeof stat);
+  p->have_last = 1;
+  poller_deliver(p, &stat, mask, 0);
+}
+
+/**
+ * Ask for statistics for the waiting subscribers
+ */
+static void
+poller_request(bme_poller_t *p)
+{
+  bmeipc_msg_t msg = {.type = BME_SYSMSG_PROXY_GETTIME,.subtype = 0 };
+
+  if (p->conn == 0)
+  {
+    if ((p->conn = bme_aconn_connect(p->loop, p->path, 0)) == 0)
+    {
+      poller_deliver(p, 0, 0, errno);
+      return;
+    }
+    /* The deadline below covers the handshake too */
+    bme_aconn_set_timeout(p->conn, 0);
+  }
+  if (bme_aconn_request(p->conn, &msg, sizeof msg, 1, poller_reply, p) == -1)
+  {
+    int error = errno;
+    bme_aconn_close(p->conn);
+    p->conn = 0;
+    poller_deliver(p, 0, 0, error);
+    return;
+  }
+  p->in_flight = 1;
+  p->deadline = now_ms() + BME_POLLER_TIMEOUT_MS;
+  p->requests++;
+}
+
+/**
+ * Give up on a request the server does not answer
+ */
+static void
+poller_timeout(bme_poller_t *p)
+{
+  log_warn_F("bme_poller: no reply in %d ms, reconnecting\n",
+             BME_POLLER_TIMEOUT_MS);
+  /* Closing drops the request without calling back */
+  bme_aconn_close(p->conn);
+  p->conn = 0;
+  p->in_flight = 0;
+  poller_deliver(p, 0, 0, ETIMEDOUT);
+}
+
+static void
+poller_tick(bme_loop_t *loop, int32_t fd, uint32_t events, void *data)
+{
+  bme_poller_t *p = data;
+  uint64_t ticks;
+  int64_t now;
+  bme_poll_sub_t *s;
+  int due = 0;
+
+  (void)loop;
+  (void)events;
+
+  if (read(fd, &ticks, sizeof ticks) == -1 && errno == EAGAIN)
+  {
+    return;
+  }
+
+  now = now_ms();
+  if (p->in_flight && p->deadline <= now)
+  {
+    p->busy++;
+    poller_timeout(p);
+    if (p->freeing)
+    {
+      poller_unbusy(p);
+      return;
+    }
+    p->busy--;
+  }
+
+  for (s = p->subs; s; s = s->next)
+  {
+    if (!s->removed && !s->waiting && s->due <= now)
+    {
+      s->waiting = 1;
+      due = 1;
+    }
+  }
+
+  p->busy++;
+  if (due && !p->in_flight)
+  {
+    poller_request(p);
+  }
+  poller_unbusy(p);
+}
+
+bme_poller_t *
+bme_poller_new(bme_loop_t *loop, const char *path)
+{
+  bme_poller_t *p;
+
+  if ((p = calloc(1, sizeof *p)) == 0)
+  {
+    return 0;
+  }
+  p->loop = loop;
+  p->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if ((path && (p->path = strdup(path)) == 0) || p->tfd == -1 ||
+      bme_loop_add(loop, p->tfd, EPOLLIN, poller_tick, p) == -1)
+  {
+    log_error_F("bme_poller_new: %s\n", strerror(errno));
+    if (p->tfd != -1)
+    {
+      close(p->tfd);
+    }
+    free(p->path);
+    free(p);
+    return 0;
+  }
+  return p;
+}
+
+void
+bme_poller_free(bme_poller_t *poller)
+{
+  if (poller == 0)
+  {
+    return;
+  }
+  if (poller->busy)
+  {
+    poller->freeing = 1;
+    return;
+  }
+  poller_destroy(poller);
+}
+
+bme_poll_sub_t *
+bme_poller_add(bme_poller_t *poller, int32_t period_ms, int32_t slack_ms,
+               bme_poll_cb cb, void *user)
+{
+  bme_poll_sub_t *s;
+
+  if (period_ms <= 0 || slack_ms < 0 || cb == 0)
+  {
+    errno = EINVAL;
+    return 0;
+  }
+  if ((s = calloc(1, sizeof *s)) == 0)
+  {
+    return 0;
+  }
+  s->poller = poller;
+  s->period = period_ms;
+  s->slack = slack_ms < period_ms ? slack_ms : period_ms;
+  s->due = now_ms();
+  s->changed = ~0u;
+  s->cb = cb;
+  s->user = user;
+
+  s->next = poller->subs;
+  poller->subs = s;
+  if (!poller->busy)
+  {
+    poller_arm(poller);
+  }
+  return s;
+}
+
+void
+bme_poller_remove(bme_poll_sub_t *sub)
+{
+  bme_poller_t *p;
+  bme_poll_sub_t **ps;
+
+  if (sub == 0)
+  {
+    return;
+  }
+  p = sub->poller;
+  if (p->busy)
+  {
+    sub->removed = 1;
+    p->reap = 1;
+    return;
+  }
+  for (ps = &p->subs; *ps != sub; ps = &(*ps)->next)
+  {
+  }
+  *ps = sub->next;
+  free(sub);
+  poller_arm(p);
+}
+
+uint32_t
+bme_poller_requests(const bme_poller_t *poller)
+{
+  return poller->requests;
+}
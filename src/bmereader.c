@@ -0,0 +1,637 @@
+/**
+   @file bmereader.c
+
+   @brief Background reader thread for a BME IPC connection
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "bmeipc.h"
+#include "bmeipc-internal.h"
+#include "bmecapture.h"
+#include "bmeframe.h"
+#include "bmereader.h"
+
+/* Largest packet accepted from the peer */
+#define READER_MAX_PACKET (1024 * 1024)
+
+/* Initial receive buffer size */
+#define READER_RX_SIZE 4096
+
+/* Requests in flight at once, power of two */
+#define READER_PENDING 64
+
+/* How long a request waits for its reply, as bme_bytes_read() */
+#define READER_TIMEOUT_MS 5000
+
+#define CACHELINE 64
+
+/**
+ * A thread waiting for its reply; lives on that thread's stack
+ */
+typedef struct
+{
+  void *buf;                    // reply data buffer, NULL if none wanted
+  int32_t size;
+  int32_t got;
+  int32_t status;
+  int error;
+  int have_status;
+  atomic_int done;              // futex word
+} waiter_t;
+
+/**
+ * Queue slot; seq says whose turn it is, see bme_reader_pop()
+ */
+typedef struct
+{
+  atomic_size_t seq;
+  int32_t size;
+  char data[BME_READER_MSG_MAX];
+} __attribute__ ((aligned(CACHELINE))) slot_t;
+
+struct bme_reader_s
+{
+  int fd;
+  int efd;                      // eventfd, readable while packets queued
+  int stopfd;                   // eventfd, tells the thread to exit
+  pthread_t thread;
+
+  /* Unsolicited packet queue: one producer, any number of consumers */
+  slot_t *q;
+  size_t qmask;
+  size_t qhead __attribute__ ((aligned(CACHELINE)));    // reader only
+  atomic_size_t qtail __attribute__ ((aligned(CACHELINE)));
+  atomic_uint dropped;
+
+  /* Waiting requests, in send order: producers serialised by send_lock */
+  pthread_mutex_t send_lock __attribute__ ((aligned(CACHELINE)));
+  atomic_size_t pend_head;
+  atomic_size_t pend_tail;
+  waiter_t *pend[READER_PENDING];
+  atomic_int dead;              // set under send_lock
+  int error;
+
+  bmeipc_rx_t rx;               // reader thread only
+};
+
+static void
+futex_wake(atomic_int *word)
+{
+  syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, 0, 0, 0);
+}
+
+static int
+futex_wait(atomic_int *word, int val, const struct timespec *rel)
+{
+  return syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, val, rel, 0, 0);
+}
+
+static void
+reader_complete(bme_reader_t *r, waiter_t *w)
+{
+  atomic_store_explicit(&r->pend_tail,
+                        atomic_load_explicit(&r->pend_tail,
+                                             memory_order_relaxed) + 1,
+                        memory_order_release);
+  /* w may be gone as soon as done is seen */
+  atomic_store_explicit(&w->done, 1, memory_order_release);
+  futex_wake(&w->done);
+}
+
+/**
+ * Queue an unsolicited packet
+ *
+ * @return 1 if queued, 0 if dropped
+ */
+static int
+reader_push(bme_reader_t *r, const char *data, int32_t size)
+{
+  size_t pos = r->qhead;
+  slot_t *slot = &r->q[pos & r->qmask];
+
+  if (size > BME_READER_MSG_MAX ||
+      atomic_load_explicit(&slot->seq, memory_order_acquire) != pos)
+  {
+    atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+    return 0;
+  }
+  slot->size = size;
+  memcpy(slot->data, data, size);
+  atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+  r->qhead = pos + 1;
+  return 1;
+}
+
+/**
+ * Route one packet to its waiting request or to the queue
+ *
+ * @return 1 if queued
+ */
+static int
+reader_deliver(bme_reader_t *r, const char *data, int32_t size)
+{
+  size_t tail = atomic_load_explicit(&r->pend_tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&r->pend_head, memory_order_acquire);
+  waiter_t *w;
+
+  _bme_capture(r->fd, BMECAP_READ, data, size);
+
+  if (tail == head)
+  {
+    return reader_push(r, data, size);
+  }
+  w = r->pend[tail % READER_PENDING];
+
+  if (!w->have_status)
+  {
+    /* Indications are never status sized; anything else is ours */
+    if (size != sizeof w->status)
+    {
+      return reader_push(r, data, size);
+    }
+    memcpy(&w->status, data, sizeof w->status);
+    w->have_status = 1;
+    if (w->status >= 0 && w->buf)
+    {
+      return 0;                 // data packet follows
+    }
+  }
+  else if (size > w->size)
+  {
+    log_warn_F("[fd=%d]: read packet: got %d, expected max %d bytes\n",
+               r->fd, size, w->size);
+    w->status = -1;
+    w->error = EBADMSG;
+  }
+  else
+  {
+    memcpy(w->buf, data, size);
+    w->got = size;
+  }
+  reader_complete(r, w);
+  return 0;
+}
+
+/**
+ * Split received bytes into packets
+ *
+ * @return number of packets queued, -1 if out of sync
+ */
+static int
+reader_parse(bme_reader_t *r)
+{
+  int queued = 0;
+
+  for (;;)
+  {
+    bmeipc_frame_t frame;
+    char *data;
+    int32_t size;
+    int32_t rc = _bme_rx_next(&r->rx, &frame, &data, &size);
+
+    if (rc == 0)
+    {
+      break;
+    }
+    if (rc == -1)
+    {
+      log_warn_F("[fd=%d]: read header: %s\n", r->fd, "out of sync");
+      return -1;
+    }
+    queued += reader_deliver(r, data, size);
+  }
+
+  _bme_rx_compact(&r->rx);
+  return queued;
+}
+
+/**
+ * Fail every waiting request and all future ones
+ */
+static void
+reader_die(bme_reader_t *r, int error)
+{
+  uint64_t one = 1;
+  size_t head;
+
+  pthread_mutex_lock(&r->send_lock);
+  r->error = error;
+  atomic_store_explicit(&r->dead, 1, memory_order_release);
+  head = atomic_load_explicit(&r->pend_head, memory_order_relaxed);
+  while (atomic_load_explicit(&r->pend_tail, memory_order_relaxed) != head)
+  {
+    waiter_t *w = r->pend[atomic_load_explicit(&r->pend_tail,
+                                               memory_order_relaxed)
+                          % READER_PENDING];
+    w->status = -1;
+    w->error = error;
+    reader_complete(r, w);
+  }
+  pthread_mutex_unlock(&r->send_lock);
+
+  /* Let consumers see the end of the stream */
+  if (write(r->efd, &one, sizeof one) == -1)
+  {
+    log_warn_F("[fd=%d]: reader wakeup: %s\n", r->fd, strerror(errno));
+  }
+}
+
+/**
+ * Give up on the connection from a requesting thread
+ */
+static void
+reader_abort(bme_reader_t *r)
+{
+  uint64_t one = 1;
+
+  shutdown(r->fd, SHUT_RDWR);
+  if (write(r->stopfd, &one, sizeof one) == -1)
+  {
+    log_warn_F("[fd=%d]: reader abort: %s\n", r->fd, strerror(errno));
+  }
+}
+
+static void *
+reader_main(void *arg)
+{
+  bme_reader_t *r = arg;
+  struct pollfd pfd[2] = {
+    {.fd = r->fd,.events = POLLIN},
+    {.fd = r->stopfd,.events = POLLIN},
+  };
+  int error = 0;
+
+  while (!error)
+  {
+    int queued = 0;
+
+    if (TEMP_FAILURE_RETRY(poll(pfd, 2, -1)) == -1)
+    {
+      error = errno;
+      break;
+    }
+    if (pfd[1].revents)
+    {
+      error = ECANCELED;
+      break;
+    }
+
+    /* Drain everything available, then wake consumers once */
+    for (;;)
+    {
+      size_t room;
+      char *p = _bme_rx_space(&r->rx, 1, &room);
+      ssize_t n;
+      int rc;
+
+      if (p == 0)
+      {
+        error = ENOMEM;
+        break;
+      }
+      n = TEMP_FAILURE_RETRY(recv(r->fd, p, room, MSG_DONTWAIT));
+      if (n == -1)
+      {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+          error = errno;
+        }
+        break;
+      }
+      if (n == 0)
+      {
+        error = ECONNRESET;
+        break;
+      }
+      r->rx.len += n;
+      if ((rc = reader_parse(r)) == -1)
+      {
+        error = EBADMSG;
+        break;
+      }
+      queued += rc;
+    }
+
+    if (queued)
+    {
+      uint64_t one = 1;
+      if (write(r->efd, &one, sizeof one) == -1)
+      {
+        log_warn_F("[fd=%d]: reader wakeup: %s\n", r->fd, strerror(errno));
+      }
+    }
+  }
+
+  if (error != ECANCELED)
+  {
+    log_warn_F("[fd=%d]: reader: %s\n", r->fd, strerror(error));
+  }
+  reader_die(r, error);
+  return 0;
+}
+
+bme_reader_t *
+bme_reader_new(int32_t fd, int32_t capacity)
+{
+  bme_reader_t *r;
+  size_t n = 1, i;
+
+  if (fd < 0)
+  {
+    errno = EBADF;
+    return 0;
+  }
+  while (n < (size_t)(capacity > 0 ? capacity : 1))
+  {
+    n <<= 1;
+  }
+
+  if (posix_memalign((void **)&r, CACHELINE, sizeof *r) != 0)
+  {
+    return 0;
+  }
+  memset(r, 0, sizeof *r);
+  r->fd = fd;
+  r->efd = r->stopfd = -1;
+  r->qmask = n - 1;
+  pthread_mutex_init(&r->send_lock, 0);
+
+  if (posix_memalign((void **)&r->q, CACHELINE, n * sizeof *r->q) != 0)
+  {
+    r->q = 0;
+    goto fail;
+  }
+  for (i = 0; i < n; i++)
+  {
+    atomic_init(&r->q[i].seq, i);
+  }
+  if (_bme_rx_init(&r->rx, READER_RX_SIZE, READER_MAX_PACKET) == -1 ||
+      (r->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1 ||
+      (r->stopfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+  {
+    goto fail;
+  }
+  if ((errno = pthread_create(&r->thread, 0, reader_main, r)) != 0)
+  {
+    log_error_F("bme_reader_new: %s\n", strerror(errno));
+    goto fail;
+  }
+  return r;
+
+fail:
+  if (r->efd != -1)
+  {
+    close(r->efd);
+  }
+  if (r->stopfd != -1)
+  {
+    close(r->stopfd);
+  }
+  pthread_mutex_destroy(&r->send_lock);
+  _bme_rx_free(&r->rx);
+  free(r->q);
+  free(r);
+  return 0;
+}
+
+void
+bme_reader_free(bme_reader_t *reader)
+{
+  uint64_t one = 1;
+
+  if (reader == 0)
+  {
+    return;
+  }
+  if (write(reader->stopfd, &one, sizeof one) == -1)
+  {
+    log_warn_F("bme_reader_free: %s\n", strerror(errno));
+  }
+  pthread_join(reader->thread, 0);
+  close(reader->efd);
+  close(reader->stopfd);
+  pthread_mutex_destroy(&reader->send_lock);
+  _bme_rx_free(&reader->rx);
+  free(reader->q);
+  free(reader);
+}
+
+int32_t
+bme_reader_send_get_reply(bme_reader_t *reader, const void *smsg,
+                          int32_t sbytes, void *rmsg, int32_t rbytes,
+                          int32_t *rbytes_act)
+{
+  const struct timespec tmo = {
+    .tv_sec = READER_TIMEOUT_MS / 1000,
+    .tv_nsec = (READER_TIMEOUT_MS % 1000) * 1000000L,
+  };
+  waiter_t w = {
+    .buf = rbytes > 0 ? rmsg : 0,
+    .size = rbytes,
+    .status = -1,
+  };
+  int error = 0;
+  size_t head;
+
+  atomic_init(&w.done, 0);
+
+  pthread_mutex_lock(&reader->send_lock);
+  if (atomic_load_explicit(&reader->dead, memory_order_relaxed))
+  {
+    errno = reader->error;
+    pthread_mutex_unlock(&reader->send_lock);
+    return -1;
+  }
+  head = atomic_load_explicit(&reader->pend_head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&reader->pend_tail, memory_order_acquire)
+      == READER_PENDING)
+  {
+    pthread_mutex_unlock(&reader->send_lock);
+    errno = EBUSY;
+    return -1;
+  }
+
+  /* Publish before sending; the reply may beat us back */
+  reader->pend[head % READER_PENDING] = &w;
+  atomic_store_explicit(&reader->pend_head, head + 1, memory_order_release);
+  if (bme_packet_write(reader->fd, smsg, sbytes) != sbytes)
+  {
+    /* Nothing will answer; the reader fails us along with the rest */
+    error = errno;
+    reader_abort(reader);
+  }
+  pthread_mutex_unlock(&reader->send_lock);
+
+  while (!atomic_load_explicit(&w.done, memory_order_acquire))
+  {
+    if (futex_wait(&w.done, 0, error ? 0 : &tmo) == -1 &&
+        errno == ETIMEDOUT)
+    {
+      /* The stream is out of step for good */
+      log_warn_F("[fd=%d] reply TIMEOUT\n", reader->fd);
+      error = ETIMEDOUT;
+      reader_abort(reader);
+    }
+  }
+
+  if (w.status < 0 && w.error)
+  {
+    errno = error ? error : w.error;
+    return -1;
+  }
+  if (w.status >= 0 && w.buf && rbytes_act)
+  {
+    *rbytes_act = w.got;
+  }
+  return w.status;
+}
+
+int32_t
+bme_reader_fd(const bme_reader_t *reader)
+{
+  return reader->efd;
+}
+
+/**
+ * Claim the oldest queued packet
+ *
+ * @return packet size, -1 if the queue is empty
+ */
+static int32_t
+reader_pop(bme_reader_t *r, void *msg, int32_t bytes)
+{
+  size_t pos = atomic_load_explicit(&r->qtail, memory_order_relaxed);
+  slot_t *slot;
+  int32_t size;
+
+  for (;;)
+  {
+    size_t seq;
+
+    slot = &r->q[pos & r->qmask];
+    seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if (seq == pos + 1)
+    {
+      if (atomic_compare_exchange_weak_explicit(&r->qtail, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if ((intptr_t) (seq - (pos + 1)) < 0)
+    {
+      return -1;
+    }
+    else
+    {
+      pos = atomic_load_explicit(&r->qtail, memory_order_relaxed);
+    }
+  }
+
+  size = slot->size;
+  memcpy(msg, slot->data, size < bytes ? size : bytes);
+  atomic_store_explicit(&slot->seq, pos + r->qmask + 1, memory_order_release);
+  return size;
+}
+
+int32_t
+bme_reader_pop(bme_reader_t *reader, void *msg, int32_t bytes)
+{
+  uint64_t count;
+  int32_t rc;
+
+  if ((rc = reader_pop(reader, msg, bytes)) != -1)
+  {
+    return rc;
+  }
+
+  /* Empty: reset the wakeup, then look again in case we raced a push */
+  if (read(reader->efd, &count, sizeof count) == -1 && errno != EAGAIN)
+  {
+    return -1;
+  }
+  if ((rc = reader_pop(reader, msg, bytes)) != -1)
+  {
+    return rc;
+  }
+
+  if (atomic_load_explicit(&reader->dead, memory_order_acquire))
+  {
+    /* Keep other consumers from sleeping through the end */
+    count = 1;
+    if (write(reader->efd, &count, sizeof count) == -1)
+    {
+      log_warn_F("bme_reader_pop: %s\n", strerror(errno));
+    }
+    errno = ECONNRESET;
+    return -1;
+  }
+  errno = EAGAIN;
+  return -1;
+}
+
+int32_t
+bme_reader_wait(bme_reader_t *reader, void *msg, int32_t bytes,
+                int32_t timeout_ms)
+{
+  struct pollfd pfd = {.fd = reader->efd,.events = POLLIN };
+  struct timeval tmo;
+  int32_t rc;
+
+  if (timeout_ms >= 0)
+  {
+    _bme_settimeout(&tmo, timeout_ms);
+  }
+
+  while ((rc = bme_reader_pop(reader, msg, bytes)) == -1 && errno == EAGAIN)
+  {
+    rc = TEMP_FAILURE_RETRY(poll(&pfd, 1, timeout_ms < 0 ? -1 :
+                                 _bme_msecsto(&tmo)));
+    if (rc == -1)
+    {
+      return -1;
+    }
+    if (rc == 0)
+    {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+  }
+  return rc;
+}
+
+uint32_t
+bme_reader_dropped(const bme_reader_t *reader)
+{
+  return atomic_load_explicit(&((bme_reader_t *)reader)->dropped,
+                              memory_order_relaxed);
+}
@@ -0,0 +1,1040 @@
+/**
+   @file bmesrv.c
+
+   @brief Fair request dispatcher for BME compatible servers
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "bmeipc.h"
+#include "bmeipc-internal.h"
+#include "bmecapture.h"
+#include "bmeframe.h"
+#include "bmeloop.h"
+#include "bmesrv.h"
+
+/* Requests handled per pass before the loop gets to do I/O again */
+#define SRV_BATCH 64
+
+/* Receive buffer, grown as needed */
+#define SRV_RX_SIZE 1024
+
+/**
+ * A queued request; the bytes stay in the client's receive buffer
+ */
+typedef struct
+{
+  size_t off;                   // payload offset in rx
+  int32_t size;
+  bmeipc_frame_t frame;
+  int rejected;
+} srv_req_t;
+
+/**
+ * A request answered after its handler returned
+ */
+struct bme_srv_request_s
+{
+  bme_srv_client_t *client;     // NULL once the client is gone
+  bme_srv_request_t *prev, *next;       // deferred requests of the client
+  bmeipc_frame_t frame;
+};
+
+struct bme_srv_client_s
+{
+  bme_srv_t *srv;
+  bme_srv_client_t *prev, *next;        // all clients
+  bme_srv_client_t *aprev, *anext;      // clients with requests to run
+  int fd;
+  int ready;                    // handshake done
+  uint32_t events;              // registered with the loop for
+  int busy;                     // inside the handler
+  int dead;                     // close when no longer busy
+  int blocked;                  // output waiting for the socket
+  int held;                     // v1 request deferred, replies in order
+  int v2;                       // has sent v2 frames, takes pushes
+  bmeipc_rx_t rx;
+  char *tx;                     // unsent reply bytes
+  size_t txoff, txlen, txcap;
+  bme_srv_request_t *deferred;
+  srv_req_t *queue;
+  uint32_t qhead, qlen, qcap;
+  int32_t weight;
+  int32_t deficit;
+  double rate, burst, tokens;
+  struct timeval refill;
+  uint32_t rejected;
+  const srv_req_t *current;
+  int replied;
+};
+
+struct bme_srv_s
+{
+  bme_loop_t *loop;
+  int ld;
+  int runfd;                    // readable while requests are queued
+  char *cookie;
+  bme_srv_handler handler;
+  bme_srv_client_cb client_cb;
+  void *user;
+  bme_srv_client_t *clients;
+  bme_srv_client_t *active;     // next turn in the round robin
+  int resume;                   // active client is in the middle of its turn
+  int32_t rate, burst, queue;
+  union
+  {
+    int64_t align;
+    char buf[BME_SRV_MAX_PACKET];
+  } scratch;                    // misaligned requests are copied here
+};
+
+static void srv_input(bme_loop_t *loop, int32_t fd, uint32_t events,
+                      void *data);
+
+static void
+srv_kick(bme_srv_t *srv)
+{
+  uint64_t one = 1;
+
+  if (write(srv->runfd, &one, sizeof one) == -1 && errno != EAGAIN)
+  {
+    log_warn_F("eventfd: %s\n", strerror(errno));
+  }
+}
+
+static void
+active_add(bme_srv_client_t *c)
+{
+  bme_srv_t *srv = c->srv;
+
+  if (srv->active == 0)
+  {
+    c->anext = c->aprev = c;
+    srv->active = c;
+    srv->resume = 0;
+    srv_kick(srv);
+    return;
+  }
+  /* Join at the end of the round */
+  c->anext = srv->active;
+  c->aprev = srv->active->aprev;
+  c->aprev->anext = c;
+  srv->active->aprev = c;
+}
+
+static void
+active_remove(bme_srv_client_t *c)
+{
+  bme_srv_t *srv = c->srv;
+
+  if (c->anext == 0)
+  {
+    return;
+  }
+  if (c->anext == c)
+  {
+    srv->active = 0;
+  }
+  else
+  {
+    c->aprev->anext = c->anext;
+    c->anext->aprev = c->aprev;
+    if (srv->active == c)
+    {
+      srv->active = c->anext;
+      srv->resume = 0;
+    }
+  }
+  c->anext = c->aprev = 0;
+  c->deficit = 0;
+}
+
+/**
+ * Give a client turns if it has requests it may run
+ */
+static void
+client_schedule(bme_srv_client_t *c)
+{
+  if (c->qlen && !c->blocked && !c->held && !c->dead && c->anext == 0)
+  {
+    active_add(c);
+  }
+}
+
+static void
+client_destroy(bme_srv_client_t *c)
+{
+  bme_srv_t *srv = c->srv;
+  bme_srv_request_t *r;
+
+  active_remove(c);
+  for (r = c->deferred; r; r = r->next)
+  {
+    r->client = 0;
+  }
+  if (c->prev)
+  {
+    c->prev->next = c->next;
+  }
+  else
+  {
+    srv->clients = c->next;
+  }
+  if (c->next)
+  {
+    c->next->prev = c->prev;
+  }
+  if (c->ready && srv->client_cb)
+  {
+    srv->client_cb(c, 0, srv->user);
+  }
+  if (c->events)
+  {
+    bme_loop_del(srv->loop, c->fd);
+  }
+  close(c->fd);
+  free(c->tx);
+  free(c->queue);
+  _bme_rx_free(&c->rx);
+  free(c);
+}
+
+/**
+ * Close now, or once the handler has returned
+ */
+static void
+client_kill(bme_srv_client_t *c)
+{
+  if (c->busy)
+  {
+    c->dead = 1;
+    active_remove(c);
+    return;
+  }
+  client_destroy(c);
+}
+
+/**
+ * Watch a client for input while its queue has room and its output
+ * is flowing, and for output while some is waiting
+ *
+ * @return 0 on success, -1 if the client was closed
+ */
+static int
+client_events(bme_srv_client_t *c)
+{
+  uint32_t ev = 0;
+  int rc;
+
+  if (c->dead)
+  {
+    return -1;
+  }
+  if (c->qlen < c->qcap && !c->blocked)
+  {
+    ev |= EPOLLIN;
+  }
+  if (c->blocked)
+  {
+    ev |= EPOLLOUT;
+  }
+  if (ev == c->events)
+  {
+    return 0;
+  }
+  if (c->events == 0)
+  {
+    rc = bme_loop_add(c->srv->loop, c->fd, ev, srv_input, c);
+  }
+  else if (ev == 0)
+  {
+    rc = bme_loop_del(c->srv->loop, c->fd);
+  }
+  else
+  {
+    rc = bme_loop_mod(c->srv->loop, c->fd, ev);
+  }
+  if (rc == -1)
+  {
+    log_warn_F("[fd=%d]: watch: %s\n", c->fd, strerror(errno));
+    client_kill(c);
+    return -1;
+  }
+  c->events = ev;
+  return 0;
+}
+
+/**
+ * Take a token from the client's bucket
+ *
+ * @return 1 if the request is within quota
+ */
+static int
+quota_take(bme_srv_client_t *c)
+{
+  struct timeval now, d;
+
+  if (c->rate <= 0)
+  {
+    return 1;
+  }
+  _bme_getmonotime(&now);
+  timersub(&now, &c->refill, &d);
+  c->refill = now;
+  c->tokens += (d.tv_sec + d.tv_usec / 1e6) * c->rate;
+  if (c->tokens > c->burst)
+  {
+    c->tokens = c->burst;
+  }
+  if (c->tokens < 1)
+  {
+    return 0;
+  }
+  c->tokens -= 1;
+  return 1;
+}
+
+/**
+ * Send queued output; what the socket does not take waits for it to
+ * become writable, and the client is not served meanwhile
+ *
+ * @return 0 on success, -1 if the client was closed
+ */
+static int
+client_flush(bme_srv_client_t *c)
+{
+  int blocked;
+
+  while (c->txoff < c->txlen)
+  {
+    ssize_t n = send(c->fd, c->tx + c->txoff, c->txlen - c->txoff,
+                     MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      log_warn_F("[fd=%d]: reply: %s\n", c->fd, strerror(errno));
+      client_kill(c);
+      return -1;
+    }
+    c->txoff += n;
+  }
+  if (c->txoff == c->txlen)
+  {
+    c->txoff = c->txlen = 0;
+  }
+
+  blocked = c->txlen > 0;
+  if (blocked != c->blocked)
+  {
+    c->blocked = blocked;
+    if (blocked)
+    {
+      active_remove(c);
+    }
+    else
+    {
+      client_schedule(c);
+    }
+  }
+  return client_events(c);
+}
+
+/**
+ * Append a packet to the client's output
+ *
+ * The payload is @head followed by @data; @frame gives the header
+ * fields of a v2 packet, NULL for a v1 one.
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+static int
+client_put(bme_srv_client_t *c, const bmeipc_frame_t *frame,
+           const void *head, int32_t hbytes, const void *data, int32_t bytes)
+{
+  bmeipc_header_v2 hdr;
+  size_t hlen = sizeof hdr.base;
+  size_t need;
+  char *p;
+
+  hdr.base.sync = BMEIPC_SYNCWORD;
+  hdr.base.size = hbytes + bytes;
+  if (frame)
+  {
+    hdr.base.sync = BMEIPC_SYNCWORD_V2;
+    hdr.reqid = frame->reqid;
+    hdr.type = frame->type;
+    hdr.flags = frame->flags;
+    hlen = sizeof hdr;
+  }
+  need = hlen + hdr.base.size;
+
+  if (c->txcap - c->txlen < need)
+  {
+    size_t cap = c->txcap ? c->txcap : SRV_RX_SIZE;
+
+    /* Sent bytes first make room, then the buffer grows */
+    if (c->txoff)
+    {
+      memmove(c->tx, c->tx + c->txoff, c->txlen - c->txoff);
+      c->txlen -= c->txoff;
+      c->txoff = 0;
+    }
+    while (cap - c->txlen < need)
+    {
+      cap *= 2;
+    }
+    if (cap != c->txcap)
+    {
+      if ((p = realloc(c->tx, cap)) == 0)
+      {
+        return -1;
+      }
+      c->tx = p;
+      c->txcap = cap;
+    }
+  }
+
+  p = c->tx + c->txlen;
+  memcpy(p, &hdr, hlen);
+  memcpy(p + hlen, head, hbytes);
+  if (bytes)
+  {
+    memcpy(p + hlen + hbytes, data, bytes);
+  }
+  _bme_capture(c->fd, BMECAP_WRITE, p + hlen, hdr.base.size);
+  c->txlen += need;
+  return 0;
+}
+
+/**
+ * Answer a request in the framing it came in, as bme_reply_write()
+ *
+ * @return 0 on success, -1 if the client was closed
+ */
+static int
+client_write(bme_srv_client_t *c, const bmeipc_frame_t *frame,
+             int32_t status, const void *data, int32_t bytes)
+{
+  int rc;
+
+  if (status < 0 || data == 0)
+  {
+    bytes = 0;
+  }
+  if (frame->version >= 2)
+  {
+    bmeipc_frame_t rep = {
+      .version = 2,
+      .reqid = frame->reqid,
+      .type = frame->type,
+      .flags = BMEIPC_F_REPLY,
+    };
+    rc = client_put(c, &rep, &status, sizeof status, data, bytes);
+  }
+  else
+  {
+    rc = client_put(c, 0, &status, sizeof status, 0, 0);
+    if (rc == 0 && bytes)
+    {
+      rc = client_put(c, 0, data, bytes, 0, 0);
+    }
+  }
+  if (rc == -1)
+  {
+    log_warn_F("[fd=%d]: reply: %s\n", c->fd, strerror(errno));
+    client_kill(c);
+    return -1;
+  }
+  return c->blocked ? 0 : client_flush(c);
+}
+
+/**
+ * Check the cookie the client opened with and answer it
+ *
+ * @return 0 on success, -1 if the client was closed
+ */
+static int
+client_hello(bme_srv_client_t *c, const char *data, int32_t size)
+{
+  if (bmeipc_cookie_check(data, size, c->srv->cookie) == -1)
+  {
+    log_warn_F("[fd=%d]: cookie mismatch: got %.*s, expected %s\n", c->fd,
+               size < BMEIPC_COOKIE_MAX ? size : BMEIPC_COOKIE_MAX, data,
+               c->srv->cookie);
+    client_kill(c);
+    return -1;
+  }
+  if (client_put(c, 0, BMEIPC_ACK_V2, 1, 0, 0) == -1)
+  {
+    log_warn_F("[fd=%d]: write ack: %s\n", c->fd, strerror(errno));
+    client_kill(c);
+    return -1;
+  }
+  if (client_flush(c) == -1)
+  {
+    return -1;
+  }
+  c->ready = 1;
+  if (c->srv->client_cb)
+  {
+    c->busy++;
+    c->srv->client_cb(c, 1, c->srv->user);
+    c->busy--;
+    if (c->dead)
+    {
+      client_destroy(c);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Queue the complete requests in the receive buffer
+ *
+ * @return 0 on success, -1 if the client was closed
+ */
+static int
+client_parse(bme_srv_client_t *c)
+{
+  while (c->qlen < c->qcap)
+  {
+    bmeipc_frame_t frame;
+    char *data;
+    int32_t size, rc;
+    int over;
+    srv_req_t *r;
+
+    rc = _bme_rx_next(&c->rx, &frame, &data, &size);
+    if (rc == 0)
+    {
+      break;
+    }
+    if (rc == -1)
+    {
+      log_warn_F("[fd=%d]: read header: %s\n", c->fd, "out of sync");
+      client_kill(c);
+      return -1;
+    }
+    if (!c->ready)
+    {
+      if (client_hello(c, data, size) == -1)
+      {
+        return -1;
+      }
+      continue;
+    }
+
+    if (frame.version >= 2)
+    {
+      c->v2 = 1;
+    }
+
+    over = !quota_take(c);
+    if (over)
+    {
+      c->rejected++;
+    }
+    if (over && (frame.version >= 2 || (c->qlen == 0 && !c->held)))
+    {
+      /* Nothing to keep in order with: answer now */
+      if (client_write(c, &frame, BME_SRV_REJECTED, 0, 0) == -1)
+      {
+        return -1;
+      }
+      continue;
+    }
+
+    r = &c->queue[(c->qhead + c->qlen) % c->qcap];
+    r->off = data - c->rx.buf;
+    r->size = size;
+    r->frame = frame;
+    r->rejected = over;
+    c->qlen++;
+    client_schedule(c);
+  }
+
+  if (c->qlen == 0)
+  {
+    _bme_rx_compact(&c->rx);
+  }
+  return client_events(c);
+}
+
+static void
+srv_input(bme_loop_t *loop, int32_t fd, uint32_t events, void *data)
+{
+  bme_srv_client_t *c = data;
+  size_t room;
+  char *p;
+  ssize_t n;
+
+  (void)loop;
+
+  if ((events & EPOLLOUT) && client_flush(c) == -1)
+  {
+    return;
+  }
+  if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR)) || !(c->events & EPOLLIN))
+  {
+    return;
+  }
+
+  if ((p = _bme_rx_space(&c->rx, SRV_RX_SIZE / 2, &room)) == 0)
+  {
+    client_kill(c);
+    return;
+  }
+
+  /* One read per wakeup, so that a busy client cannot hog the loop */
+  n = recv(fd, p, room, MSG_DONTWAIT);
+  if (n == 0 || (n == -1 && errno != EAGAIN && errno != EINTR))
+  {
+    client_kill(c);
+    return;
+  }
+  if (n > 0)
+  {
+    c->rx.len += n;
+    client_parse(c);
+  }
+}
+
+/**
+ * Hand the request at the head of a client's queue to the handler
+ *
+ * @return 0 on success, -1 if the client was closed
+ */
+static int
+client_dispatch(bme_srv_client_t *c)
+{
+  bme_srv_t *srv = c->srv;
+  const srv_req_t *r = &c->queue[c->qhead];
+
+  if (r->rejected)
+  {
+    if (client_write(c, &r->frame, BME_SRV_REJECTED, 0, 0) == -1)
+    {
+      return -1;
+    }
+  }
+  else
+  {
+    const char *req = c->rx.buf + r->off;
+
+    if ((uintptr_t) req % sizeof srv->scratch.align)
+    {
+      memcpy(srv->scratch.buf, req, r->size);
+      req = srv->scratch.buf;
+    }
+    c->current = r;
+    c->replied = 0;
+    c->busy++;
+    srv->handler(c, &r->frame, req, r->size, srv->user);
+    c->busy--;
+    c->current = 0;
+    if (c->dead)
+    {
+      client_destroy(c);
+      return -1;
+    }
+    if (!c->replied)
+    {
+      log_warn_F("[fd=%d]: request 0x%x not answered\n", c->fd,
+                 r->frame.type);
+      if (client_write(c, &r->frame, -1, 0, 0) == -1)
+      {
+        return -1;
+      }
+    }
+  }
+
+  c->qhead = (c->qhead + 1) % c->qcap;
+  if (c->held)
+  {
+    active_remove(c);
+  }
+  if (--c->qlen == 0)
+  {
+    /* Queue empty: client_parse() moves the unparsed bytes to the front */
+    c->qhead = 0;
+    active_remove(c);
+    return client_parse(c);
+  }
+  return 0;
+}
+
+static void
+srv_run(bme_loop_t *loop, int32_t fd, uint32_t events, void *data)
+{
+  bme_srv_t *srv = data;
+  int budget = SRV_BATCH;
+  uint64_t n;
+
+  (void)loop;
+  (void)events;
+
+  if (read(fd, &n, sizeof n) == -1 && errno == EAGAIN)
+  {
+    return;
+  }
+
+  while (budget > 0 && srv->active)
+  {
+    bme_srv_client_t *c = srv->active;
+
+    if (!srv->resume)
+    {
+      c->deficit += c->weight;
+      srv->resume = 1;
+    }
+    while (budget > 0 && srv->active == c &&
+           (c->deficit > 0 || c->queue[c->qhead].rejected))
+    {
+      if (!c->queue[c->qhead].rejected)
+      {
+        c->deficit--;
+      }
+      budget--;
+      if (client_dispatch(c) == -1)
+      {
+        break;
+      }
+    }
+    if (budget > 0 && srv->active == c)
+    {
+      /* Turn used up: on to the next client */
+      srv->active = c->anext;
+      srv->resume = 0;
+    }
+  }
+
+  if (srv->active)
+  {
+    srv_kick(srv);
+  }
+}
+
+static void
+srv_accept(bme_loop_t *loop, int32_t fd, uint32_t events, void *data)
+{
+  bme_srv_t *srv = data;
+  bme_srv_client_t *c;
+  int cfd;
+
+  (void)events;
+
+  if ((cfd = accept4(fd, 0, 0, SOCK_CLOEXEC | SOCK_NONBLOCK)) == -1)
+  {
+    if (errno != EAGAIN && errno != EINTR)
+    {
+      log_warn_F("accept: %s\n", strerror(errno));
+    }
+    return;
+  }
+  if ((c = calloc(1, sizeof *c)) == 0 ||
+      _bme_rx_init(&c->rx, SRV_RX_SIZE, BME_SRV_MAX_PACKET) == -1 ||
+      (c->queue = calloc(srv->queue, sizeof *c->queue)) == 0 ||
+      bme_loop_add(loop, cfd, EPOLLIN, srv_input, c) == -1)
+  {
+    log_warn_F("accept: %s\n", strerror(errno));
+    if (c)
+    {
+      _bme_rx_free(&c->rx);
+      free(c->queue);
+      free(c);
+    }
+    close(cfd);
+    return;
+  }
+
+  c->srv = srv;
+  c->fd = cfd;
+  c->events = EPOLLIN;
+  c->qcap = srv->queue;
+  c->weight = 1;
+  bme_srv_client_set_quota(c, srv->rate, srv->burst);
+
+  c->next = srv->clients;
+  if (c->next)
+  {
+    c->next->prev = c;
+  }
+  srv->clients = c;
+}
+
+bme_srv_t *
+bme_srv_new(bme_loop_t *loop, const char *path, const char *cookie,
+            bme_srv_handler handler, void *user)
+{
+  struct sockaddr_un addr;
+  bme_srv_t *srv;
+
+  if (path == 0 || handler == 0)
+  {
+    errno = EINVAL;
+    return 0;
+  }
+  if ((srv = calloc(1, sizeof *srv)) == 0)
+  {
+    return 0;
+  }
+  srv->loop = loop;
+  srv->handler = handler;
+  srv->user = user;
+  srv->queue = BME_SRV_QUEUE;
+  srv->runfd = -1;
+
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  strncat(addr.sun_path, path, sizeof addr.sun_path - 1);
+  unlink(addr.sun_path);
+
+  srv->ld = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (srv->ld == -1 ||
+      bind(srv->ld, (struct sockaddr *)&addr, sizeof addr) == -1 ||
+      listen(srv->ld, SOMAXCONN) == -1 ||
+      (srv->cookie = strdup(cookie ? cookie : BME_SRV_COOKIE)) == 0 ||
+      (srv->runfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1 ||
+      bme_loop_add(loop, srv->ld, EPOLLIN, srv_accept, srv) == -1)
+  {
+    log_error_F("bme_srv_new: %s: %s\n", path, strerror(errno));
+    goto fail;
+  }
+  if (bme_loop_add(loop, srv->runfd, EPOLLIN, srv_run, srv) == -1)
+  {
+    log_error_F("bme_srv_new: %s\n", strerror(errno));
+    bme_loop_del(loop, srv->ld);
+    goto fail;
+  }
+  return srv;
+
+fail:
+  if (srv->ld != -1)
+  {
+    close(srv->ld);
+  }
+  if (srv->runfd != -1)
+  {
+    close(srv->runfd);
+  }
+  free(srv->cookie);
+  free(srv);
+  return 0;
+}
+
+void
+bme_srv_free(bme_srv_t *srv)
+{
+  if (srv == 0)
+  {
+    return;
+  }
+  while (srv->clients)
+  {
+    client_destroy(srv->clients);
+  }
+  bme_loop_del(srv->loop, srv->ld);
+  bme_loop_del(srv->loop, srv->runfd);
+  close(srv->ld);
+  close(srv->runfd);
+  free(srv->cookie);
+  free(srv);
+}
+
+int32_t
+bme_srv_broadcast(bme_srv_t *srv, const void *data, int32_t bytes)
+{
+  bmeipc_frame_t push = {.version = 2,.flags = BMEIPC_F_PUSH };
+  bme_srv_client_t *c, *next;
+  int32_t sent = 0;
+
+  if (bytes >= (int32_t) sizeof push.type)
+  {
+    memcpy(&push.type, data, sizeof push.type);
+  }
+
+  for (c = srv->clients; c; c = next)
+  {
+    next = c->next;
+    if (!c->v2 || c->dead)
+    {
+      continue;
+    }
+    if (client_put(c, &push, data, bytes, 0, 0) == -1)
+    {
+      log_warn_F("[fd=%d]: send: %s\n", c->fd, strerror(errno));
+      client_kill(c);
+      continue;
+    }
+    if (!c->blocked && client_flush(c) == -1)
+    {
+      continue;
+    }
+    sent++;
+  }
+  return sent;
+}
+
+void
+bme_srv_set_client_handler(bme_srv_t *srv, bme_srv_client_cb cb)
+{
+  srv->client_cb = cb;
+}
+
+void
+bme_srv_set_limits(bme_srv_t *srv, int32_t rate, int32_t burst,
+                   int32_t queue)
+{
+  srv->rate = rate;
+  srv->burst = burst;
+  srv->queue = queue > 0 ? queue : BME_SRV_QUEUE;
+}
+
+int32_t
+bme_srv_reply(bme_srv_client_t *client, int32_t status, const void *data,
+              int32_t bytes)
+{
+  if (client->current == 0 || client->replied)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  client->replied = 1;
+  if (client->dead)
+  {
+    errno = ECONNRESET;
+    return -1;
+  }
+  return client_write(client, &client->current->frame, status, data, bytes);
+}
+
+void
+bme_srv_client_close(bme_srv_client_t *client)
+{
+  client_kill(client);
+}
+
+int32_t
+bme_srv_client_fd(const bme_srv_client_t *client)
+{
+  return client->fd;
+}
+
+void
+bme_srv_client_set_weight(bme_srv_client_t *client, int32_t weight)
+{
+  client->weight = weight > 0 ? weight : 1;
+}
+
+void
+bme_srv_client_set_quota(bme_srv_client_t *client, int32_t rate,
+                         int32_t burst)
+{
+  client->rate = rate;
+  client->burst = burst > 1 ? burst : 1;
+  client->tokens = client->burst;
+  _bme_getmonotime(&client->refill);
+}
+
+uint32_t
+bme_srv_client_rejected(const bme_srv_client_t *client)
+{
+  return client->rejected;
+}
+
+bme_srv_request_t *
+bme_srv_defer(bme_srv_client_t *client)
+{
+  bme_srv_request_t *r;
+
+  if (client->current == 0 || client->replied)
+  {
+    errno = EINVAL;
+    return 0;
+  }
+  if ((r = calloc(1, sizeof *r)) == 0)
+  {
+    return 0;
+  }
+  r->client = client;
+  r->frame = client->current->frame;
+  r->next = client->deferred;
+  if (r->next)
+  {
+    r->next->prev = r;
+  }
+  client->deferred = r;
+  client->replied = 1;
+  if (r->frame.version < 2)
+  {
+    client->held = 1;
+  }
+  return r;
+}
+
+int32_t
+bme_srv_request_reply(bme_srv_request_t *request, int32_t status,
+                      const void *data, int32_t bytes)
+{
+  bme_srv_client_t *c = request->client;
+  int32_t rc = -1;
+
+  if (c)
+  {
+    if (request->prev)
+    {
+      request->prev->next = request->next;
+    }
+    else
+    {
+      c->deferred = request->next;
+    }
+    if (request->next)
+    {
+      request->next->prev = request->prev;
+    }
+    if (request->frame.version < 2)
+    {
+      c->held = 0;
+    }
+  }
+  if (c == 0 || c->dead)
+  {
+    errno = ECONNRESET;
+  }
+  else if ((rc = client_write(c, &request->frame, status, data, bytes)) == 0)
+  {
+    client_schedule(c);
+  }
+  free(request);
+  return rc;
+}
@@ -0,0 +1,341 @@
+/**
+   @file bmestat.c
+
+   @brief BME statistics snapshot helpers
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BMESTAT_X86 1
+#endif
+
+#include "bmeipc.h"
+#include "bmeipc-internal.h"
+#include "bmestat.h"
+
+typedef uint32_t (*diff_mask_fn) (const int32_t *, const int32_t *);
+
+/**
+ * Portable changed-slot mask
+ */
+static uint32_t
+diff_mask_scalar(const int32_t *a, const int32_t *b)
+{
+  uint32_t mask = 0;
+  int i;
+
+  for (i = 0; i < BME_LAST_STAT_IDX; i++)
+  {
+    mask |= (uint32_t) (a[i] != b[i]) << i;
+  }
+  return mask;
+}
+
+#ifdef BMESTAT_X86
+/**
+ * Changed-slot mask, four slots per compare
+ */
+__attribute__ ((target("sse2")))
+static uint32_t
+diff_mask_sse2(const int32_t *a, const int32_t *b)
+{
+  uint32_t mask = 0;
+  int i;
+
+  for (i = 0; i < BME_LAST_STAT_IDX; i += 4)
+  {
+    __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+    __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+    __m128i eq = _mm_cmpeq_epi32(x, y);
+
+    mask |= (uint32_t) (~_mm_movemask_ps(_mm_castsi128_ps(eq)) & 0xf) << i;
+  }
+  return mask;
+}
+
+/**
+ * Changed-slot mask, eight slots per compare
+ */
+__attribute__ ((target("avx2")))
+static uint32_t
+diff_mask_avx2(const int32_t *a, const int32_t *b)
+{
+  uint32_t mask = 0;
+  int i;
+
+  for (i = 0; i < BME_LAST_STAT_IDX; i += 8)
+  {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+    __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+    __m256i eq = _mm256_cmpeq_epi32(x, y);
+
+    mask |= (uint32_t) (~_mm256_movemask_ps(_mm256_castsi256_ps(eq)) & 0xff)
+      << i;
+  }
+  return mask;
+}
+#endif
+
+/**
+ * Pick the best mask implementation for the running cpu
+ */
+static uint32_t
+diff_mask_init(const int32_t *a, const int32_t *b);
+
+static diff_mask_fn diff_mask = diff_mask_init;
+
+static uint32_t
+diff_mask_init(const int32_t *a, const int32_t *b)
+{
+  diff_mask_fn fn = diff_mask_scalar;
+
+#ifdef BMESTAT_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+  {
+    fn = diff_mask_avx2;
+  }
+  else if (__builtin_cpu_supports("sse2"))
+  {
+    fn = diff_mask_sse2;
+  }
+#endif
+
+  /* Racing threads all store the same value */
+  diff_mask = fn;
+  return fn(a, b);
+}
+
+uint32_t
+bmestat_diff(const bmestat_t *prev, const bmestat_t *cur, int32_t *delta)
+{
+  uint32_t mask = diff_mask(*prev, *cur);
+
+  if (delta)
+  {
+    uint32_t todo = mask;
+    int n = 0;
+
+    while (todo)
+    {
+      delta[n++] = (*cur)[__builtin_ctz(todo)];
+      todo &= todo - 1;
+    }
+  }
+  return mask;
+}
+
+int32_t
+bmestat_patch(bmestat_t *stat, uint32_t mask, const int32_t *delta)
+{
+  int n = 0;
+
+  while (mask)
+  {
+    (*stat)[__builtin_ctz(mask)] = delta[n++];
+    mask &= mask - 1;
+  }
+  return n;
+}
+
+/**
+ * Generation after @gen, skipping the reserved values
+ */
+static uint32_t
+next_gen(uint32_t gen)
+{
+  do
+  {
+    gen++;
+  }
+  while (gen == BMESTAT_GEN_NONE || gen == BMESTAT_GEN_LEGACY);
+  return gen;
+}
+
+/**
+ * Forget all history; every client gets a full reply next time
+ */
+static void
+log_rebase(bmestat_log_t *log, uint32_t base)
+{
+  int i;
+
+  log->base = log->gen = base;
+  for (i = 0; i < BME_LAST_STAT_IDX; i++)
+  {
+    log->changed[i] = base;
+  }
+}
+
+void
+bmestat_log_init(bmestat_log_t *log, uint32_t base)
+{
+  if (base == BMESTAT_GEN_NONE)
+  {
+    /* Clients reconnecting after a restart must not match old generations */
+    base = (uint32_t) time(0) ^ ((uint32_t) getpid() << 16);
+  }
+  if (base == BMESTAT_GEN_NONE || base == BMESTAT_GEN_LEGACY)
+  {
+    base = next_gen(base);
+  }
+  memset(log->stat, 0, sizeof log->stat);
+  log_rebase(log, base);
+}
+
+uint32_t
+bmestat_log_update(bmestat_log_t *log, const bmestat_t *cur)
+{
+  uint32_t mask = bmestat_diff(&log->stat, cur, 0);
+
+  if (mask == 0)
+  {
+    return log->gen;
+  }
+
+  log->gen = next_gen(log->gen);
+  if (log->gen == log->base)
+  {
+    /* Wrapped around; old generations would look new */
+    log_rebase(log, log->gen);
+  }
+  while (mask)
+  {
+    log->changed[__builtin_ctz(mask)] = log->gen;
+    mask &= mask - 1;
+  }
+  memcpy(log->stat, *cur, sizeof log->stat);
+  return log->gen;
+}
+
+int32_t
+bmestat_log_encode(const bmestat_log_t *log, uint32_t since, void *buf)
+{
+  bmestat_delta_reply_t head = {.gen = log->gen,.mask = 0 };
+  int32_t *val = (int32_t *)((char *)buf + sizeof head);
+  uint32_t age = since - log->base;
+  int i, n = 0;
+
+  if (since == BMESTAT_GEN_NONE || since == BMESTAT_GEN_LEGACY ||
+      age > log->gen - log->base)
+  {
+    head.mask = ~0u;
+    memcpy(val, log->stat, sizeof log->stat);
+    n = BME_LAST_STAT_IDX;
+  }
+  else
+  {
+    for (i = 0; i < BME_LAST_STAT_IDX; i++)
+    {
+      if (log->changed[i] - log->base > age)
+      {
+        head.mask |= 1u << i;
+        val[n++] = log->stat[i];
+      }
+    }
+  }
+
+  memcpy(buf, &head, sizeof head);
+  return sizeof head + n * sizeof *val;
+}
+
+/**
+ * Full request for servers without delta support
+ */
+static int32_t
+stat_full(int32_t sd, bmestat_t *stat)
+{
+  bmestat_t cur;
+
+  if (bmeipc_stat(sd, &cur) == -1)
+  {
+    return -1;
+  }
+  if (bmestat_diff(stat, &cur, 0) == 0)
+  {
+    return 0;
+  }
+  memcpy(*stat, cur, sizeof cur);
+  return 1;
+}
+
+int32_t
+bmeipc_stat_delta(int32_t sd, bmestat_t *stat, uint32_t *gen)
+{
+  bmestat_delta_req_t rq = {
+    .type = BME_SYSMSG_PROXY_GETTIME_DELTA,.subtype = 0,.gen = *gen
+  };
+  int32_t buf[BMESTAT_DELTA_MAX / sizeof(int32_t)];
+  bmestat_delta_reply_t head;
+  int32_t n = 0, status, rc;
+
+  if (*gen == BMESTAT_GEN_LEGACY)
+  {
+    return stat_full(sd, stat);
+  }
+
+  /* Exchange by hand: only a status from the server tells that it
+   * lacks delta support, a timeout or I/O error does not */
+  if (bme_write(sd, &rq, sizeof rq) != sizeof rq ||
+      bme_read(sd, &status, sizeof status) != sizeof status)
+  {
+    return -1;
+  }
+  if (status < 0)
+  {
+    if ((rc = stat_full(sd, stat)) != -1)
+    {
+      *gen = BMESTAT_GEN_LEGACY;
+    }
+    return rc;
+  }
+  if ((n = bme_read(sd, buf, sizeof buf)) == -1)
+  {
+    return -1;
+  }
+
+  if (n < (int32_t) sizeof head)
+  {
+    goto bad_reply;
+  }
+  memcpy(&head, buf, sizeof head);
+  if (n != (int32_t) (sizeof head + bmestat_delta_count(head.mask) * sizeof *buf))
+  {
+    goto bad_reply;
+  }
+
+  *gen = head.gen;
+  if (head.mask == 0)
+  {
+    return 0;
+  }
+  bmestat_patch(stat, head.mask, buf + sizeof head / sizeof *buf);
+  return 1;
+
+bad_reply:
+  log_warn_F("bmeipc_stat_delta: bad reply of %d bytes\n", n);
+  errno = EBADMSG;
+  return -1;
+}
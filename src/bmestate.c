@@ -0,0 +1,119 @@
+/**
+   @file bmestate.c
+
+   @brief Statistics, battery info and charger state in one request
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "bmeipc.h"
+#include "bmeipc-internal.h"
+#include "bmemsg.h"
+#include "bmesrv.h"
+#include "bmestate.h"
+
+/**
+ * Separate requests for servers without BME_SYSMSG_FULL_STATE
+ */
+static int32_t
+state_legacy(int32_t sd, uint32_t flags, bmeipc_full_state_t *state)
+{
+  struct emsg_battery_info_req rq = {
+    .type = BME_BATTERY_INFO_REQ,.subtype = 0,.flags = flags
+  };
+  int32_t n = 0;
+
+  memset(state, 0, sizeof *state);
+  state->valid = BME_FULL_STATE_LEGACY;
+
+  /* Neither call has to set errno when the server says no */
+  errno = 0;
+  if (bmeipc_stat(sd, &state->stat) == 0)
+  {
+    state->valid |= BME_FULL_STATE_STAT;
+  }
+  if (bme_send_get_reply(sd, &rq, sizeof rq, &state->info,
+                         sizeof state->info, &n) >= 0 &&
+      n == sizeof state->info)
+  {
+    state->valid |= BME_FULL_STATE_INFO;
+  }
+
+  if (state->valid == BME_FULL_STATE_LEGACY)
+  {
+    if (errno == 0)
+    {
+      errno = EIO;
+    }
+    return -1;
+  }
+  return 0;
+}
+
+int32_t
+bmeipc_full_state(int32_t sd, uint32_t flags, bmeipc_full_state_t *state)
+{
+  bmeipc_full_state_req_t rq = {
+    .type = BME_SYSMSG_FULL_STATE,.subtype = 0,.flags = flags
+  };
+  union
+  {
+    bmeipc_full_state_t state;
+    char raw[BME_FULL_STATE_MAX];
+  } buf;
+  int32_t n, status;
+
+  if (state->valid & BME_FULL_STATE_LEGACY)
+  {
+    return state_legacy(sd, flags, state);
+  }
+
+  /* Exchange by hand: only a status from the server tells that it
+   * lacks the request, a timeout or I/O error does not */
+  if (bme_write(sd, &rq, sizeof rq) != sizeof rq ||
+      bme_read(sd, &status, sizeof status) != sizeof status)
+  {
+    return -1;
+  }
+  if (status == BME_FULL_STATE_RETRY || status == BME_SRV_REJECTED)
+  {
+    errno = EAGAIN;
+    return -1;
+  }
+  if (status < 0)
+  {
+    return state_legacy(sd, flags, state);
+  }
+  if ((n = bme_read(sd, &buf, sizeof buf)) == -1)
+  {
+    return -1;
+  }
+
+  if (n < (int32_t) sizeof *state)
+  {
+    log_warn_F("bmeipc_full_state: bad reply of %d bytes\n", n);
+    errno = EBADMSG;
+    return -1;
+  }
+  memcpy(state, &buf.state, sizeof *state);
+  state->valid &= ~BME_FULL_STATE_LEGACY;
+  return 0;
+}
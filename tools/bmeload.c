@@ -0,0 +1,657 @@
+/**
+   @file bmeload.c
+
+   @brief Load generator for BME compatible servers
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Opens connections at a steady rate up to a limit, each doing the
+ * usual cookie handshake, and has every ready connection send a mix
+ * of BME_SYSMSG_GETPID, BME_SYSMSG_PROXY_GETTIME and
+ * BME_BATTERY_INFO_REQ at a fixed rate. Requests are sent on schedule
+ * whether or not earlier ones were answered, up to a per-connection
+ * limit, so a slow server shows up as latency instead of as a lower
+ * offered load. Indications the server pushes are counted.
+ *
+ * Every interval a line shows the load offered and what came back:
+ * throughput, reply latency percentiles and the accept latency of the
+ * connections that became ready, measured from connect() to the reply
+ * to the first request sent behind the cookie. As connections ramp
+ * up, the point where latency climbs or connections get refused is the
+ * server's saturation point.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+
+#include "bmeipc.h"
+#include "bmemsg.h"
+#include "bmeloop.h"
+#include "bmeasync.h"
+
+/* Scheduling granularity */
+#define TICK_MS 5
+
+/* Latency histogram: exact below LAT_SUB usec, then LAT_SUB / 2
+ * buckets per power of two, about 6% wide */
+#define LAT_SUB 32
+#define LAT_BUCKETS ((64 - 4) * (LAT_SUB / 2) + LAT_SUB)
+
+typedef struct
+{
+  uint64_t count[LAT_BUCKETS];
+  uint64_t n;
+  uint64_t max;
+} lat_hist_t;
+
+typedef struct client_s client_t;
+
+typedef struct
+{
+  client_t *client;
+  uint64_t sent;
+  int hello;                    // first request, times the accept
+  int busy;
+} req_t;
+
+/* Per-connection request slots, the most that may be unanswered */
+#define MAX_OUTSTANDING 64
+
+struct client_s
+{
+  bme_aconn_t *conn;
+  uint64_t opened;
+  int ready;                    // first reply seen
+  int outstanding;
+  req_t req[MAX_OUTSTANDING];
+};
+
+typedef struct
+{
+  uint64_t sent;
+  uint64_t replies;
+  uint64_t rejected;            // negative status from the server
+  uint64_t errors;              // failed requests
+  uint64_t stalled;             // not sent, too many outstanding
+  uint64_t refused;             // connect() or handshake failed
+  uint64_t dropped;             // ready connections lost
+  uint64_t ind;
+  lat_hist_t lat;
+  lat_hist_t accept;
+} counters_t;
+
+static const char *path = BME_SRV_SOCK_PATH;
+static int max_conns = 1000;
+static int max_outstanding = 16;
+static double ramp = 100;       // connections per second
+static double rate = 1;         // requests per second per connection
+static int mix[3] = { 1, 1, 1 };        // GETPID, GETTIME, BATTERY_INFO
+static uint32_t info_flags = 0x3ff;
+static int duration = 60;
+static int interval = 1;
+
+static bme_loop_t *loop;
+static client_t **clients;
+static int nclients, nready, next_client;
+static uint64_t start, last_tick, last_report;
+static double owed_conns, owed_reqs;
+static counters_t now, total;
+static uint64_t rng = 0x9e3779b97f4a7c15ull;
+
+static uint64_t
+now_usec(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+static uint32_t
+random32(void)
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return rng >> 32;
+}
+
+static int
+lat_bucket(uint64_t v)
+{
+  int msb;
+
+  if (v < LAT_SUB)
+  {
+    return v;
+  }
+  msb = 63 - __builtin_clzll(v);
+  return (msb - 4) * (LAT_SUB / 2) + (int)(v >> (msb - 4));
+}
+
+static uint64_t
+lat_value(int bucket)
+{
+  int msb;
+
+  if (bucket < LAT_SUB)
+  {
+    return bucket;
+  }
+  msb = bucket / (LAT_SUB / 2) + 3;
+  return (uint64_t) (bucket % (LAT_SUB / 2) + LAT_SUB / 2) << (msb - 4);
+}
+
+static void
+lat_add(lat_hist_t *h, uint64_t v)
+{
+  h->count[lat_bucket(v)]++;
+  h->n++;
+  if (v > h->max)
+  {
+    h->max = v;
+  }
+}
+
+static void
+lat_merge(lat_hist_t *to, const lat_hist_t *from)
+{
+  int i;
+
+  for (i = 0; i < LAT_BUCKETS; i++)
+  {
+    to->count[i] += from->count[i];
+  }
+  to->n += from->n;
+  if (from->max > to->max)
+  {
+    to->max = from->max;
+  }
+}
+
+/**
+ * Value below which a fraction @q of the samples fall
+ */
+static uint64_t
+lat_quantile(const lat_hist_t *h, double q)
+{
+  uint64_t want = (uint64_t) (q * h->n), seen = 0;
+  int i;
+
+  if (h->n == 0)
+  {
+    return 0;
+  }
+  for (i = 0; i < LAT_BUCKETS; i++)
+  {
+    seen += h->count[i];
+    if (seen > want)
+    {
+      return lat_value(i);
+    }
+  }
+  return h->max;
+}
+
+static void
+counters_merge(counters_t *to, const counters_t *from)
+{
+  to->sent += from->sent;
+  to->replies += from->replies;
+  to->rejected += from->rejected;
+  to->errors += from->errors;
+  to->stalled += from->stalled;
+  to->refused += from->refused;
+  to->dropped += from->dropped;
+  to->ind += from->ind;
+  lat_merge(&to->lat, &from->lat);
+  lat_merge(&to->accept, &from->accept);
+}
+
+static void
+client_close(int i)
+{
+  client_t *cl = clients[i];
+
+  if (cl->ready)
+  {
+    nready--;
+    now.dropped++;
+  }
+  else
+  {
+    now.refused++;
+  }
+  bme_aconn_close(cl->conn);
+  free(cl);
+  clients[i] = clients[--nclients];
+  if (next_client >= nclients)
+  {
+    next_client = 0;
+  }
+}
+
+static void
+client_lost(client_t *cl)
+{
+  int i;
+
+  for (i = 0; i < nclients; i++)
+  {
+    if (clients[i] == cl)
+    {
+      client_close(i);
+      return;
+    }
+  }
+}
+
+static void
+on_reply(bme_aconn_t *conn, int32_t status, const void *data, int32_t bytes,
+         void *user)
+{
+  req_t *r = user;
+  client_t *cl = r->client;
+  uint64_t t = now_usec();
+
+  (void)conn;
+  (void)data;
+  (void)bytes;
+
+  r->busy = 0;
+  cl->outstanding--;
+
+  if (status < 0 && errno != 0)
+  {
+    now.errors++;
+    client_lost(cl);
+    return;
+  }
+  if (r->hello)
+  {
+    cl->ready = 1;
+    nready++;
+    lat_add(&now.accept, t - cl->opened);
+    return;
+  }
+  lat_add(&now.lat, t - r->sent);
+  if (status < 0)
+  {
+    now.rejected++;
+  }
+  else
+  {
+    now.replies++;
+  }
+}
+
+static void
+on_packet(bme_aconn_t *conn, const void *data, int32_t bytes, void *user)
+{
+  const struct emsg_info_ind *ind = data;
+
+  (void)conn;
+
+  if (data == 0)
+  {
+    now.errors++;
+    client_lost(user);
+    return;
+  }
+  if (bytes >= (int32_t) sizeof *ind && ind->type == BME_INFO_IND)
+  {
+    now.ind++;
+  }
+}
+
+/**
+ * Send one request of the configured mix
+ *
+ * @return 0 on success, -1 if the connection failed
+ */
+static int
+client_request(client_t *cl, int hello)
+{
+  struct emsg_battery_info_req info = {
+    .type = BME_BATTERY_INFO_REQ,.subtype = 0,.flags = info_flags
+  };
+  bmeipc_msg_t msg = {.type = BME_SYSMSG_GETPID,.subtype = 0 };
+  const void *req = &msg;
+  int32_t len = sizeof msg;
+  uint32_t pick;
+  req_t *r;
+  int i;
+
+  for (i = 0; cl->req[i].busy; i++)
+  {
+  }
+  r = &cl->req[i];
+
+  pick = hello ? 0 : random32() % (mix[0] + mix[1] + mix[2]);
+  if (pick >= (uint32_t) mix[0] + mix[1])
+  {
+    req = &info;
+    len = sizeof info;
+  }
+  else if (pick >= (uint32_t) mix[0])
+  {
+    msg.type = BME_SYSMSG_PROXY_GETTIME;
+  }
+
+  r->client = cl;
+  r->sent = now_usec();
+  r->hello = hello;
+  if (bme_aconn_request(cl->conn, req, len, 1, on_reply, r) == -1)
+  {
+    return -1;
+  }
+  r->busy = 1;
+  cl->outstanding++;
+  if (!hello)
+  {
+    now.sent++;
+  }
+  return 0;
+}
+
+static void
+client_open(void)
+{
+  client_t *cl = calloc(1, sizeof *cl);
+
+  if (cl == 0)
+  {
+    now.refused++;
+    return;
+  }
+  cl->opened = now_usec();
+  if ((cl->conn = bme_aconn_connect(loop, path, 0)) == 0)
+  {
+    now.refused++;
+    free(cl);
+    return;
+  }
+  bme_aconn_set_packet_handler(cl->conn, on_packet, cl);
+  clients[nclients++] = cl;
+  if (client_request(cl, 1) == -1)
+  {
+    client_close(nclients - 1);
+  }
+}
+
+static void
+report(uint64_t t, const counters_t *c, double secs, int final)
+{
+  if (final)
+  {
+    printf("\n%6s", "total");
+  }
+  else
+  {
+    printf("%6.1f", (t - start) / 1e6);
+  }
+  printf(" %6d %6d %6llu %6llu %9.0f %7llu %6llu %6llu"
+         " %6llu %6llu %7llu %7llu %7llu %7llu %8.0f\n",
+         nclients, nready,
+         (unsigned long long)c->refused, (unsigned long long)c->dropped,
+         c->replies / secs,
+         (unsigned long long)c->rejected, (unsigned long long)c->errors,
+         (unsigned long long)c->stalled,
+         (unsigned long long)lat_quantile(&c->lat, 0.5),
+         (unsigned long long)lat_quantile(&c->lat, 0.99),
+         (unsigned long long)lat_quantile(&c->lat, 0.999),
+         (unsigned long long)c->lat.max,
+         (unsigned long long)lat_quantile(&c->accept, 0.5),
+         (unsigned long long)lat_quantile(&c->accept, 0.99),
+         c->ind / secs);
+  fflush(stdout);
+}
+
+static void
+tick(bme_loop_t *l, int32_t fd, uint32_t events, void *data)
+{
+  uint64_t ticks, t = now_usec();
+  double dt = (t - last_tick) / 1e6;
+  int n;
+
+  (void)events;
+  (void)data;
+
+  if (read(fd, &ticks, sizeof ticks) == -1 && errno == EAGAIN)
+  {
+    return;
+  }
+  last_tick = t;
+
+  /* Ramp up, and replace connections that were lost */
+  owed_conns += ramp * dt;
+  for (n = (int)owed_conns; n > 0 && nclients < max_conns; n--)
+  {
+    client_open();
+  }
+  owed_conns -= (int)owed_conns;
+  if (owed_conns > ramp)
+  {
+    owed_conns = ramp;
+  }
+
+  /* Requests due from the ready connections, round robin */
+  owed_reqs += rate * nready * dt;
+  for (n = (int)owed_reqs; n > 0 && nready > 0; n--)
+  {
+    client_t *cl;
+
+    do
+    {
+      cl = clients[next_client];
+      next_client = (next_client + 1) % nclients;
+    }
+    while (!cl->ready);
+
+    if (cl->outstanding >= max_outstanding)
+    {
+      now.stalled++;
+    }
+    else if (client_request(cl, 0) == -1)
+    {
+      now.errors++;
+      client_lost(cl);
+    }
+  }
+  owed_reqs -= (int)owed_reqs;
+
+  if (t - last_report >= (uint64_t) interval * 1000000)
+  {
+    report(t, &now, (t - last_report) / 1e6, 0);
+    counters_merge(&total, &now);
+    memset(&now, 0, sizeof now);
+    last_report = t;
+  }
+
+  if (t - start >= (uint64_t) duration * 1000000)
+  {
+    bme_loop_quit(l);
+  }
+}
+
+/**
+ * Parse a request mix given as pid:stat:info weights
+ */
+static int
+parse_mix(const char *arg)
+{
+  if (sscanf(arg, "%d:%d:%d", &mix[0], &mix[1], &mix[2]) != 3 ||
+      mix[0] < 0 || mix[1] < 0 || mix[2] < 0 ||
+      mix[0] + mix[1] + mix[2] == 0)
+  {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Allow a descriptor per connection
+ */
+static void
+raise_fd_limit(void)
+{
+  struct rlimit rl;
+
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+  {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 &&
+      rl.rlim_cur != RLIM_INFINITY && (rlim_t) max_conns + 16 > rl.rlim_cur)
+  {
+    max_conns = rl.rlim_cur - 16;
+    fprintf(stderr, "descriptor limit allows only %d connections\n",
+            max_conns);
+  }
+}
+
+static void
+usage(const char *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [-s path] [-c conns] [-r rate] [-q rate] [-m mix]\n"
+          "          [-f flags] [-o count] [-t sec] [-i sec]\n"
+          "  -s path   server socket (default %s)\n"
+          "  -c conns  connections to ramp up to (default %d)\n"
+          "  -r rate   new connections per second (default %.0f)\n"
+          "  -q rate   requests per second per connection (default %.0f)\n"
+          "  -m mix    GETPID:GETTIME:BATTERY_INFO weights (default 1:1:1)\n"
+          "  -f flags  BME_BATTERY_* flags of info requests (default 0x%x)\n"
+          "  -o count  unanswered requests per connection, at most %d"
+          " (default %d)\n"
+          "  -t sec    run time (default %d)\n"
+          "  -i sec    report interval (default %d)\n",
+          prog, BME_SRV_SOCK_PATH, max_conns, ramp, rate, info_flags,
+          MAX_OUTSTANDING, max_outstanding, duration, interval);
+}
+
+int
+main(int argc, char **argv)
+{
+  struct itimerspec its = {
+    .it_interval = {.tv_sec = 0,.tv_nsec = TICK_MS * 1000000L},
+    .it_value = {.tv_sec = 0,.tv_nsec = TICK_MS * 1000000L},
+  };
+  int opt, tfd;
+  uint64_t t;
+
+  while ((opt = getopt(argc, argv, "s:c:r:q:m:f:o:t:i:h")) != -1)
+  {
+    switch (opt)
+    {
+    case 's':
+      path = optarg;
+      break;
+    case 'c':
+      max_conns = atoi(optarg);
+      break;
+    case 'r':
+      ramp = atof(optarg);
+      break;
+    case 'q':
+      rate = atof(optarg);
+      break;
+    case 'm':
+      if (parse_mix(optarg) == -1)
+      {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'f':
+      info_flags = strtoul(optarg, 0, 0);
+      break;
+    case 'o':
+      max_outstanding = atoi(optarg);
+      break;
+    case 't':
+      duration = atoi(optarg);
+      break;
+    case 'i':
+      interval = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+  if (optind != argc || max_conns <= 0 || ramp <= 0 || rate < 0 ||
+      max_outstanding <= 0 || max_outstanding > MAX_OUTSTANDING ||
+      duration <= 0 || interval <= 0)
+  {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  raise_fd_limit();
+
+  if ((clients = calloc(max_conns, sizeof *clients)) == 0 ||
+      (loop = bme_loop_new()) == 0 ||
+      (tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1 ||
+      bme_loop_add(loop, tfd, EPOLLIN, tick, 0) == -1 ||
+      timerfd_settime(tfd, 0, &its, 0) == -1)
+  {
+    fprintf(stderr, "setup: %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  printf("%6s %6s %6s %6s %6s %9s %7s %6s %6s %6s %6s %7s %7s %7s %7s %8s\n",
+         "time", "conns", "ready", "refuse", "drop", "replies/s", "reject",
+         "error", "stall", "p50", "p99", "p99.9", "max", "acc-p50",
+         "acc-p99", "ind/s");
+
+  start = last_tick = last_report = now_usec();
+  if (bme_loop_run(loop) == -1)
+  {
+    fprintf(stderr, "event loop: %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  t = now_usec();
+  counters_merge(&total, &now);
+  report(t, &total, (t - start) / 1e6, 1);
+  printf("latencies in usec; stall counts requests not sent because %d "
+         "were unanswered\n", max_outstanding);
+
+  while (nclients > 0)
+  {
+    client_close(nclients - 1);
+  }
+  bme_loop_del(loop, tfd);
+  close(tfd);
+  bme_loop_free(loop);
+  free(clients);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,693 @@
+/**
+   @file bmeproxy.c
+
+   @brief Caching BME IPC proxy
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Accepts any number of local clients speaking the normal BME framing
+ * and handshake, and funnels their requests through one upstream
+ * connection. BME_SYSMSG_GETPID, BME_SYSMSG_PROXY_GETTIME and
+ * BME_BATTERY_INFO_REQ replies are cached for a short time, and clients
+ * asking for the same one while it is being fetched share the server's
+ * reply. BME_SYSMSG_PROXY_GETTIME_DELTA is answered from the cached
+ * statistics, whatever the server supports. BME_SYSMSG_FULL_STATE is
+ * assembled from the cached statistics and battery info and the last
+ * BME_INFO_IND the server sent. Other requests are refused: with v1
+ * framing the proxy could not tell whether a data packet follows the
+ * server's status.
+ *
+ * Packets the server sends unasked, such as BME_INFO_IND, are pushed
+ * on to the clients that speak v2 framing; v1 framing has no way to
+ * mark them apart from replies.
+ *
+ * The proxy itself answers BME_SYSMSG_PROXY_OPEN with its own PID, so
+ * that clients can tell they are being proxied, and BME_SYSMSG_PROXY_CLOSE
+ * by acknowledging and hanging up.
+ *
+ * Clients are served through the fair dispatcher, so one client with a
+ * deep pipeline cannot starve the rest; -q and -b put a per-client
+ * quota on requests on top of that. The upstream connection is driven
+ * by the same event loop: a request that needs the server is deferred
+ * and answered when the reply comes in, so a slow server only holds
+ * up the clients waiting on it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <getopt.h>
+#include <syslog.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "bmeipc.h"
+#include "bmemsg.h"
+#include "bmestat.h"
+#include "bmestate.h"
+#include "bmeloop.h"
+#include "bmeasync.h"
+#include "bmesrv.h"
+
+#define PROXY_SOCK_PATH "/tmp/.bmeproxy"
+
+/* Largest packet passed through */
+#define MAX_PACKET BME_SRV_MAX_PACKET
+
+/* Cached replies */
+#define CACHE_SLOTS 16
+#define CACHE_DATA  256
+
+typedef struct
+{
+  int valid;
+  uint32_t type;
+  uint32_t flags;
+  struct timeval expires;
+  int32_t status;
+  int32_t size;
+  char data[CACHE_DATA];
+} cache_entry_t;
+
+/**
+ * What to do with the server's reply to a request
+ */
+typedef void (*fetch_cb) (int32_t status, const void *data, int32_t size,
+                          void *user);
+
+typedef struct waiter_s
+{
+  struct waiter_s *next;
+  fetch_cb cb;
+  void *user;
+} waiter_t;
+
+/**
+ * A request passed upstream, and everyone waiting for its reply
+ */
+typedef struct fetch_s
+{
+  struct fetch_s *next;         // requests in flight
+  uint32_t type;
+  uint32_t flags;
+  waiter_t *waiters;
+} fetch_t;
+
+/**
+ * A client request built from one or more server replies
+ */
+typedef struct
+{
+  bme_srv_request_t *req;
+  uint32_t since;               // delta: generation the client has
+  int pending;                  // full state: replies still to come
+  bmeipc_full_state_t st;       // full state: parts collected
+} job_t;
+
+static const char *upstream_path = BME_SRV_SOCK_PATH;
+static bme_loop_t *loop;
+static bme_srv_t *srv;
+static bme_aconn_t *upstream;
+static fetch_t *fetching;
+static int cache_ttl_ms = 500;
+static cache_entry_t cache[CACHE_SLOTS];
+static bmestat_log_t statlog;
+static struct emsg_info_ind last_ind;
+static int have_ind;
+
+static void
+timeval_now(struct timeval *tv)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  TIMESPEC_TO_TIMEVAL(tv, &t);
+}
+
+static cache_entry_t *
+cache_lookup(uint32_t type, uint32_t flags)
+{
+  struct timeval now;
+  int i;
+
+  timeval_now(&now);
+  for (i = 0; i < CACHE_SLOTS; i++)
+  {
+    cache_entry_t *e = &cache[i];
+    if (e->valid && e->type == type && e->flags == flags &&
+        timercmp(&now, &e->expires, <))
+    {
+      return e;
+    }
+  }
+  return 0;
+}
+
+static void
+cache_store(uint32_t type, uint32_t flags, int32_t status,
+            const void *data, int32_t size)
+{
+  cache_entry_t *slot = 0;
+  struct timeval ttl = {
+    .tv_sec = cache_ttl_ms / 1000,
+    .tv_usec = (cache_ttl_ms % 1000) * 1000,
+  };
+  int i;
+
+  if (size > CACHE_DATA || cache_ttl_ms <= 0)
+  {
+    return;
+  }
+
+  /* Same key, else a free slot, else the one expiring first */
+  for (i = 0; i < CACHE_SLOTS; i++)
+  {
+    cache_entry_t *e = &cache[i];
+    if (e->valid && e->type == type && e->flags == flags)
+    {
+      slot = e;
+      break;
+    }
+    if (!slot || (slot->valid && (!e->valid ||
+                                  timercmp(&e->expires, &slot->expires, <))))
+    {
+      slot = e;
+    }
+  }
+
+  slot->valid = 1;
+  slot->type = type;
+  slot->flags = flags;
+  slot->status = status;
+  slot->size = size;
+  memcpy(slot->data, data, size);
+  timeval_now(&slot->expires);
+  timeradd(&slot->expires, &ttl, &slot->expires);
+}
+
+/**
+ * Push on a packet the server sent unasked, keeping info indications
+ */
+static void
+upstream_ind(const void *data, int32_t size)
+{
+  struct emsg_info_ind ind;
+
+  bme_srv_broadcast(srv, data, size);
+
+  if (size != sizeof ind)
+  {
+    return;
+  }
+  memcpy(&ind, data, sizeof ind);
+  if (ind.type != BME_INFO_IND)
+  {
+    return;
+  }
+  last_ind = ind;
+  have_ind = 1;
+}
+
+/**
+ * Take indications, and drop the connection when it fails; pending
+ * requests have been failed by then
+ */
+static void
+upstream_packet(bme_aconn_t *conn, const void *data, int32_t bytes,
+                void *user)
+{
+  (void)user;
+
+  if (bytes == -1)
+  {
+    syslog(LOG_WARNING, "upstream %s: %s", upstream_path, strerror(errno));
+    bme_aconn_close(conn);
+    if (upstream == conn)
+    {
+      upstream = 0;
+    }
+    return;
+  }
+  upstream_ind(data, bytes);
+}
+
+static bme_aconn_t *
+upstream_get(void)
+{
+  if (upstream == 0)
+  {
+    if ((upstream = bme_aconn_connect(loop, upstream_path,
+                                      BME_SRV_COOKIE)) == 0)
+    {
+      syslog(LOG_WARNING, "connect %s: %s", upstream_path, strerror(errno));
+      return 0;
+    }
+    bme_aconn_set_packet_handler(upstream, upstream_packet, 0);
+  }
+  return upstream;
+}
+
+/**
+ * Hand the server's reply to everyone waiting for it
+ */
+static void
+fetch_done(bme_aconn_t *conn, int32_t status, const void *data,
+           int32_t size, void *user)
+{
+  fetch_t *f = user, **pp;
+  waiter_t *w;
+
+  (void)conn;
+
+  for (pp = &fetching; *pp != f; pp = &(*pp)->next)
+  {
+  }
+  *pp = f->next;
+  if (status >= 0)
+  {
+    cache_store(f->type, f->flags, status, data, size);
+  }
+  while ((w = f->waiters) != 0)
+  {
+    f->waiters = w->next;
+    w->cb(status, data, size, w->user);
+    free(w);
+  }
+  free(f);
+}
+
+/**
+ * Get a reply from the cache, else from the server
+ *
+ * Only for requests whose non-negative status is followed by a data
+ * packet. @cb is called once with the reply, from here on a cache hit
+ * and from the event loop otherwise. A request already on its way
+ * upstream is not sent again.
+ *
+ * @return 0 on success, -1 if the request could not be sent; @cb is
+ *         then not called
+ */
+static int
+fetch(const void *req, int32_t len, uint32_t type, uint32_t flags,
+      fetch_cb cb, void *user)
+{
+  cache_entry_t *e;
+  fetch_t *f;
+  waiter_t *w;
+
+  if ((e = cache_lookup(type, flags)) != 0)
+  {
+    cb(e->status, e->data, e->size, user);
+    return 0;
+  }
+  for (f = fetching; f; f = f->next)
+  {
+    if (f->type == type && f->flags == flags)
+    {
+      break;
+    }
+  }
+
+  if ((w = malloc(sizeof *w)) == 0)
+  {
+    return -1;
+  }
+  w->cb = cb;
+  w->user = user;
+
+  if (f == 0)
+  {
+    bme_aconn_t *conn = upstream_get();
+
+    if (conn == 0 || (f = calloc(1, sizeof *f)) == 0)
+    {
+      free(w);
+      return -1;
+    }
+    f->type = type;
+    f->flags = flags;
+    if (bme_aconn_request(conn, req, len, 1, fetch_done, f) == -1)
+    {
+      free(f);
+      free(w);
+      return -1;
+    }
+    f->next = fetching;
+    fetching = f;
+  }
+  w->next = f->waiters;
+  f->waiters = w;
+  return 0;
+}
+
+/**
+ * Pass the server's reply on to the client
+ */
+static void
+reply_done(int32_t status, const void *data, int32_t size, void *user)
+{
+  bme_srv_request_reply(user, status, data, size);
+}
+
+/**
+ * Answer a request with the server's reply, deferring it if the reply
+ * is not at hand
+ */
+static void
+forward(bme_srv_client_t *client, const void *req, int32_t len,
+        uint32_t type, uint32_t flags)
+{
+  bme_srv_request_t *r;
+  cache_entry_t *e;
+
+  if ((e = cache_lookup(type, flags)) != 0)
+  {
+    bme_srv_reply(client, e->status, e->data, e->size);
+    return;
+  }
+  if ((r = bme_srv_defer(client)) == 0)
+  {
+    bme_srv_reply(client, -1, 0, 0);
+    return;
+  }
+  if (fetch(req, len, type, flags, reply_done, r) == -1)
+  {
+    bme_srv_request_reply(r, -1, 0, 0);
+  }
+}
+
+/**
+ * Answer a delta request from fresh statistics
+ */
+static void
+delta_done(int32_t status, const void *data, int32_t size, void *user)
+{
+  int32_t buf[MAX_PACKET / sizeof(int32_t)];
+  job_t *j = user;
+  bmestat_t stat;
+
+  if (status < 0 || size != sizeof stat)
+  {
+    bme_srv_request_reply(j->req, -1, 0, 0);
+  }
+  else
+  {
+    memcpy(stat, data, sizeof stat);
+    bmestat_log_update(&statlog, (const bmestat_t *)&stat);
+    size = bmestat_log_encode(&statlog, j->since, buf);
+    bme_srv_request_reply(j->req, 0, buf, size);
+  }
+  free(j);
+}
+
+/**
+ * Answer a full state request once all parts are in
+ */
+static void
+state_part(job_t *j)
+{
+  if (--j->pending > 0)
+  {
+    return;
+  }
+  if (have_ind)
+  {
+    memcpy(&j->st.ind, &last_ind, sizeof j->st.ind);
+    j->st.valid |= BME_FULL_STATE_IND;
+  }
+  if (j->st.valid == 0)
+  {
+    /* Not -1, which would tell the client the request is unknown */
+    bme_srv_request_reply(j->req, BME_FULL_STATE_RETRY, 0, 0);
+  }
+  else
+  {
+    bme_srv_request_reply(j->req, 0, &j->st, sizeof j->st);
+  }
+  free(j);
+}
+
+static void
+state_stat_done(int32_t status, const void *data, int32_t size, void *user)
+{
+  job_t *j = user;
+
+  if (status >= 0 && size == sizeof j->st.stat)
+  {
+    memcpy(j->st.stat, data, size);
+    j->st.valid |= BME_FULL_STATE_STAT;
+  }
+  state_part(j);
+}
+
+static void
+state_info_done(int32_t status, const void *data, int32_t size, void *user)
+{
+  job_t *j = user;
+
+  if (status >= 0 && size == sizeof j->st.info)
+  {
+    memcpy(&j->st.info, data, size);
+    j->st.valid |= BME_FULL_STATE_INFO;
+  }
+  state_part(j);
+}
+
+/**
+ * Start a job that answers a request of @client; the reply is left to
+ * the job
+ *
+ * @return job, NULL if the request was answered with status @fail
+ */
+static job_t *
+job_new(bme_srv_client_t *client, int32_t fail)
+{
+  job_t *j = calloc(1, sizeof *j);
+
+  if (j == 0 || (j->req = bme_srv_defer(client)) == 0)
+  {
+    free(j);
+    bme_srv_reply(client, fail, 0, 0);
+    return 0;
+  }
+  return j;
+}
+
+/**
+ * Assemble a full state reply from the cached parts
+ */
+static void
+serve_full_state(bme_srv_client_t *client, const void *req, int len)
+{
+  bmeipc_msg_t rq = {.type = BME_SYSMSG_PROXY_GETTIME,.subtype = 0 };
+  struct emsg_battery_info_req irq = {
+    .type = BME_BATTERY_INFO_REQ,.subtype = 0,.flags = 0
+  };
+  job_t *j;
+
+  if (len >= (int)sizeof(bmeipc_full_state_req_t))
+  {
+    irq.flags = ((const bmeipc_full_state_req_t *)req)->flags;
+  }
+  if ((j = job_new(client, BME_FULL_STATE_RETRY)) == 0)
+  {
+    return;
+  }
+
+  /* Held until both parts have been asked for */
+  j->pending = 3;
+  if (fetch(&rq, sizeof rq, rq.type, 0, state_stat_done, j) == -1)
+  {
+    j->pending--;
+  }
+  if (fetch(&irq, sizeof irq, irq.type, irq.flags, state_info_done,
+            j) == -1)
+  {
+    j->pending--;
+  }
+  state_part(j);
+}
+
+/**
+ * Serve one request from a client
+ */
+static void
+serve(bme_srv_client_t *client, const bmeipc_frame_t *frame,
+      const void *req, int32_t len, void *user)
+{
+  const bmeipc_msg_t *msg = req;
+  uint32_t flags = 0;
+
+  (void)frame;
+  (void)user;
+
+  if (len < (int)sizeof *msg)
+  {
+    bme_srv_reply(client, -1, 0, 0);
+    return;
+  }
+
+  switch (msg->type)
+  {
+  case BME_SYSMSG_PROXY_OPEN:
+    {
+      bmeipc_pid_t pid = {.zero = 0,.pid = getpid() };
+      bme_srv_reply(client, 0, &pid, sizeof pid);
+      return;
+    }
+
+  case BME_SYSMSG_PROXY_CLOSE:
+    bme_srv_reply(client, 0, 0, 0);
+    bme_srv_client_close(client);
+    return;
+
+  case BME_BATTERY_INFO_REQ:
+    if (len < (int)sizeof(struct emsg_battery_info_req))
+    {
+      break;
+    }
+    flags = ((const struct emsg_battery_info_req *)req)->flags;
+    /* fall through */
+  case BME_SYSMSG_GETPID:
+  case BME_SYSMSG_PROXY_GETTIME:
+    forward(client, req, len, msg->type, flags);
+    return;
+
+  case BME_SYSMSG_PROXY_GETTIME_DELTA:
+    {
+      bmeipc_msg_t rq = {.type = BME_SYSMSG_PROXY_GETTIME,.subtype = 0 };
+      job_t *j;
+
+      if ((j = job_new(client, -1)) == 0)
+      {
+        return;
+      }
+      j->since = BMESTAT_GEN_NONE;
+      if (len >= (int)sizeof(bmestat_delta_req_t))
+      {
+        j->since = ((const bmestat_delta_req_t *)req)->gen;
+      }
+      if (fetch(&rq, sizeof rq, rq.type, 0, delta_done, j) == -1)
+      {
+        delta_done(-1, 0, 0, j);
+      }
+      return;
+    }
+
+  case BME_SYSMSG_FULL_STATE:
+    serve_full_state(client, req, len);
+    return;
+  }
+
+  /* Where its reply ends is unknown */
+  bme_srv_reply(client, -1, 0, 0);
+}
+
+static void
+usage(const char *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [-s path] [-u path] [-t msec] [-q rate] [-b burst]"
+          " [-Q len] [-d]\n"
+          "  -s path  socket to accept clients on (default %s)\n"
+          "  -u path  upstream server socket (default %s)\n"
+          "  -t msec  reply cache lifetime, 0 disables (default %d)\n"
+          "  -q rate  requests per second per client, 0 for no limit"
+          " (default 0)\n"
+          "  -b burst requests a client may send at once (default rate)\n"
+          "  -Q len   requests queued per client (default %d)\n"
+          "  -d       run in background\n",
+          prog, PROXY_SOCK_PATH, BME_SRV_SOCK_PATH, cache_ttl_ms,
+          BME_SRV_QUEUE);
+}
+
+int
+main(int argc, char **argv)
+{
+  const char *listen_path = PROXY_SOCK_PATH;
+  int background = 0, opt;
+  int rate = 0, burst = 0, queue = 0;
+
+  while ((opt = getopt(argc, argv, "s:u:t:q:b:Q:dh")) != -1)
+  {
+    switch (opt)
+    {
+    case 's':
+      listen_path = optarg;
+      break;
+    case 'u':
+      upstream_path = optarg;
+      break;
+    case 't':
+      cache_ttl_ms = atoi(optarg);
+      break;
+    case 'q':
+      rate = atoi(optarg);
+      break;
+    case 'b':
+      burst = atoi(optarg);
+      break;
+    case 'Q':
+      queue = atoi(optarg);
+      break;
+    case 'd':
+      background = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  openlog("bmeproxy", LOG_PID, LOG_DAEMON);
+
+  if ((loop = bme_loop_new()) == 0 ||
+      (srv = bme_srv_new(loop, listen_path, BME_SRV_COOKIE, serve, 0)) == 0)
+  {
+    fprintf(stderr, "listen %s: %s\n", listen_path, strerror(errno));
+    return EXIT_FAILURE;
+  }
+  bme_srv_set_limits(srv, rate, burst > 0 ? burst : rate, queue);
+
+  if (background && daemon(0, 0) == -1)
+  {
+    fprintf(stderr, "daemon: %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+  bmestat_log_init(&statlog, BMESTAT_GEN_NONE);
+
+  /* Connect early so that indications are passed on from the start */
+  upstream_get();
+
+  if (bme_loop_run(loop) == -1)
+  {
+    syslog(LOG_ERR, "event loop: %s", strerror(errno));
+  }
+
+  bme_srv_free(srv);
+  if (upstream)
+  {
+    bme_aconn_close(upstream);
+  }
+  bme_loop_free(loop);
+  return EXIT_FAILURE;
+}
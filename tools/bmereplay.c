@@ -0,0 +1,348 @@
+/**
+   @file bmereplay.c
+
+   @brief Replay captured BME IPC traffic
+   <p>
+   Copyright (C) 2010 Nokia Corporation.
+
+   This file is part of libopenbme.
+
+   Libbme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Libbme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with libopenbme. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Replays one side of a capture made with bmeipc_capture_start().
+ * Packets the captured process wrote are sent, packets it read are
+ * received and timed against the preceding send. Cookie handshake packets are part
+ * of the capture, so a client capture replays against a live server
+ * with -c and a server capture answers a live client with -l.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+
+#include "bmeipc.h"
+#include "bmecapture.h"
+
+#define READ_BUF_SIZE (64 * 1024)
+
+typedef struct
+{
+  bmecap_record_t rec;
+  void *data;
+} record_t;
+
+static uint64_t
+now_usec(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+static void
+sleep_until(uint64_t usec)
+{
+  struct timespec t = {
+    .tv_sec = usec / 1000000,
+    .tv_nsec = (usec % 1000000) * 1000,
+  };
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, 0) == EINTR)
+  {
+  }
+}
+
+/**
+ * Load records of one descriptor, the first one seen if @fd is -1
+ */
+static record_t *
+load_capture(const char *path, int fd, size_t *count)
+{
+  bmecap_file_header_t head;
+  bmecap_record_t rec;
+  record_t *recs = 0;
+  size_t n = 0, cap = 0;
+  FILE *f;
+
+  if ((f = fopen(path, "r")) == 0)
+  {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return 0;
+  }
+  if (fread(&head, sizeof head, 1, f) != 1 ||
+      head.magic != BMECAP_MAGIC || head.version != BMECAP_VERSION)
+  {
+    fprintf(stderr, "%s: not a capture file\n", path);
+    goto fail;
+  }
+
+  while (fread(&rec, sizeof rec, 1, f) == 1)
+  {
+    void *data = 0;
+
+    if (rec.size < 0 || (rec.size && (data = malloc(rec.size)) == 0) ||
+        fread(data, 1, rec.size, f) != (size_t) rec.size)
+    {
+      fprintf(stderr, "%s: truncated record\n", path);
+      free(data);
+      goto fail;
+    }
+    if (fd == -1)
+    {
+      fd = rec.fd;
+    }
+    if (rec.fd != fd)
+    {
+      free(data);
+      continue;
+    }
+    if (n == cap)
+    {
+      record_t *r;
+      cap = cap ? cap * 2 : 256;
+      if ((r = realloc(recs, cap * sizeof *recs)) == 0)
+      {
+        free(data);
+        goto fail;
+      }
+      recs = r;
+    }
+    recs[n].rec = rec;
+    recs[n].data = data;
+    n++;
+  }
+
+  fclose(f);
+  *count = n;
+  return recs;
+
+fail:
+  while (n)
+  {
+    free(recs[--n].data);
+  }
+  free(recs);
+  fclose(f);
+  return 0;
+}
+
+static int
+connect_to(const char *path)
+{
+  struct sockaddr_un addr;
+  int sd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  strncat(addr.sun_path, path, sizeof addr.sun_path - 1);
+
+  if (sd == -1 || connect(sd, (struct sockaddr *)&addr, sizeof addr) == -1)
+  {
+    fprintf(stderr, "connect %s: %s\n", path, strerror(errno));
+    if (sd != -1)
+      close(sd);
+    return -1;
+  }
+  return sd;
+}
+
+static int
+accept_on(const char *path)
+{
+  struct sockaddr_un addr;
+  int ld = socket(AF_UNIX, SOCK_STREAM, 0);
+  int sd = -1;
+
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  strncat(addr.sun_path, path, sizeof addr.sun_path - 1);
+  unlink(path);
+
+  if (ld == -1 || bind(ld, (struct sockaddr *)&addr, sizeof addr) == -1 ||
+      listen(ld, 1) == -1)
+  {
+    fprintf(stderr, "listen %s: %s\n", path, strerror(errno));
+  }
+  else if ((sd = accept(ld, 0, 0)) == -1)
+  {
+    fprintf(stderr, "accept %s: %s\n", path, strerror(errno));
+  }
+  if (ld != -1)
+    close(ld);
+  return sd;
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void
+usage(const char *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [-f] [-d fd] (-c path | -l path) capture\n"
+          "  -c path  connect to a server and replay the client side\n"
+          "  -l path  listen for a client and replay the server side\n"
+          "  -d fd    replay records of this descriptor (default: first)\n"
+          "  -f       send as fast as possible instead of captured timing\n",
+          prog);
+}
+
+int
+main(int argc, char **argv)
+{
+  const char *connect_path = 0, *listen_path = 0;
+  int fd = -1, fast = 0, opt, sd;
+  size_t count = 0, i, nlat = 0, mismatch = 0, nwrite = 0, nread = 0;
+  record_t *recs;
+  uint64_t *lat, t0, cap0, last_write = 0, start, elapsed;
+  char *buf;
+  struct rusage ru;
+
+  while ((opt = getopt(argc, argv, "c:l:d:fh")) != -1)
+  {
+    switch (opt)
+    {
+    case 'c':
+      connect_path = optarg;
+      break;
+    case 'l':
+      listen_path = optarg;
+      break;
+    case 'd':
+      fd = atoi(optarg);
+      break;
+    case 'f':
+      fast = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+  if (optind != argc - 1 || !connect_path == !listen_path)
+  {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if ((recs = load_capture(argv[optind], fd, &count)) == 0)
+  {
+    return EXIT_FAILURE;
+  }
+  if (count == 0)
+  {
+    fprintf(stderr, "%s: no records\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+
+  sd = connect_path ? connect_to(connect_path) : accept_on(listen_path);
+  if (sd == -1)
+  {
+    return EXIT_FAILURE;
+  }
+
+  lat = calloc(count, sizeof *lat);
+  buf = malloc(READ_BUF_SIZE);
+  if (lat == 0 || buf == 0)
+  {
+    fprintf(stderr, "out of memory\n");
+    return EXIT_FAILURE;
+  }
+
+  start = t0 = now_usec();
+  cap0 = recs[0].rec.usec;
+
+  for (i = 0; i < count; i++)
+  {
+    const bmecap_record_t *r = &recs[i].rec;
+
+    if (r->dir == BMECAP_WRITE)
+    {
+      if (!fast)
+      {
+        sleep_until(t0 + (r->usec - cap0));
+      }
+      last_write = now_usec();
+      if (bme_packet_write(sd, recs[i].data, r->size) != r->size)
+      {
+        fprintf(stderr, "record %zu: write failed: %s\n", i, strerror(errno));
+        break;
+      }
+      nwrite++;
+    }
+    else if (r->dir == BMECAP_READ)
+    {
+      int got = bme_packet_read(sd, buf, READ_BUF_SIZE);
+
+      if (got <= 0)
+      {
+        fprintf(stderr, "record %zu: read failed: %s\n", i,
+                got ? strerror(errno) : "EOF");
+        break;
+      }
+      if (got != r->size || memcmp(buf, recs[i].data, got))
+      {
+        mismatch++;
+      }
+      if (last_write)
+      {
+        lat[nlat++] = now_usec() - last_write;
+        last_write = 0;
+      }
+      nread++;
+    }
+  }
+
+  elapsed = now_usec() - start;
+  getrusage(RUSAGE_SELF, &ru);
+  close(sd);
+
+  printf("records:   %zu/%zu replayed, %zu written, %zu read, "
+         "%zu differing\n", nwrite + nread, count, nwrite, nread, mismatch);
+  printf("wall:      %.3f s (captured %.3f s)\n", elapsed / 1e6,
+         (recs[count - 1].rec.usec - cap0) / 1e6);
+  printf("cpu:       user %ld.%06ld s, sys %ld.%06ld s\n",
+         (long)ru.ru_utime.tv_sec, (long)ru.ru_utime.tv_usec,
+         (long)ru.ru_stime.tv_sec, (long)ru.ru_stime.tv_usec);
+
+  if (nlat)
+  {
+    uint64_t sum = 0;
+    size_t k;
+
+    qsort(lat, nlat, sizeof *lat, cmp_u64);
+    for (k = 0; k < nlat; k++)
+    {
+      sum += lat[k];
+    }
+    printf("latency:   min %llu, avg %llu, p50 %llu, p99 %llu, max %llu usec\n",
+           (unsigned long long)lat[0], (unsigned long long)(sum / nlat),
+           (unsigned long long)lat[nlat / 2],
+           (unsigned long long)lat[(nlat * 99) / 100],
+           (unsigned long long)lat[nlat - 1]);
+  }
+
+  return nwrite + nread == count ? EXIT_SUCCESS : EXIT_FAILURE;
+}